@@ -0,0 +1,383 @@
+// Efficiency benchmark.
+// Starts the virtual cable, the receiver and the transmitter for every
+// combination of line bit rate, propagation delay, maximum payload, window
+// and bit error rate given, and writes the throughput, efficiency and retransmissions of each
+// transfer as CSV and JSON. Needs what the cable needs (socat, /dev access).
+//
+// Usage: bench [-f file] [-b rates] [-d delays] [-p payloads] [-w windows]
+//              [-e bers] [-a gbn|sr] [-s seed] [-t seconds] [-c csv] [-j json]
+//              [-o cable options]
+// Lists are comma separated, e.g. -b 9600,38400 -e 0,1e-5. A window of 1
+// runs stop-and-wait, larger windows the ARQ given with -a. -o passes more
+// error model options to every cable, e.g. -o "-g 1e-5,1e-2,0.1 -l 0.001".
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FALSE 0
+#define TRUE 1
+#define MAX_VALUES 16
+#define TX_PORT "/dev/ttyS10"
+#define RX_PORT "/dev/ttyS11"
+
+typedef struct
+{
+    double values[MAX_VALUES];
+    int count;
+} List;
+
+typedef struct
+{
+    int index;
+    int baudRate;
+    double delayMs; // one-way propagation delay
+    int maxPayload;
+    int window;
+    double bitErrorRate;
+
+    int completed; // transmitter finished before the timeout
+    int identical; // file received matches the one sent
+    double seconds;
+    double throughput; // file bits per second
+    double efficiency; // throughput over the line bit rate
+    unsigned long long framesSent, bytesSent;
+    unsigned long long retransmissions, timeouts, rejReceived;
+} Run;
+
+char binDir[4096] = ".";
+char workDir[] = "/tmp/bench.XXXXXX";
+const char *arq = "gbn";
+unsigned long long seed = 1;
+int runTimeout = 120;
+const char *cableOptions = ""; // space separated
+
+double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void parseList(const char *text, List *list)
+{
+    char copy[1024];
+    snprintf(copy, sizeof(copy), "%s", text);
+    list->count = 0;
+    for(char *item = strtok(copy, ","); item != NULL && list->count < MAX_VALUES;
+        item = strtok(NULL, ","))
+        list->values[list->count++] = atof(item);
+}
+
+/**
+ * @brief Runs argv with its output in logPath, its input from inputFd (or
+ * /dev/null if -1) and the NULL terminated name=value pairs in env.
+ *
+ * @return pid of the child, -1 on error
+ */
+pid_t spawn(char *const argv[], const char *logPath, int inputFd, const char *const env[])
+{
+    pid_t pid = fork();
+    if(pid != 0) return pid;
+
+    int out = open(logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int in = (inputFd >= 0) ? inputFd : open("/dev/null", O_RDONLY);
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    dup2(out, STDERR_FILENO);
+    for(int i = 0; env != NULL && env[i] != NULL; i += 2) setenv(env[i], env[i+1], TRUE);
+    execv(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+}
+
+// Waits for pid up to seconds, killing it once they are over.
+// Return TRUE if it exited by itself.
+int waitFor(pid_t pid, double seconds)
+{
+    double deadline = nowSeconds() + seconds;
+    while(nowSeconds() < deadline){
+        if(waitpid(pid, NULL, WNOHANG) == pid) return TRUE;
+        usleep(10000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return FALSE;
+}
+
+// Return TRUE if the files have the same contents
+int sameFiles(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int same = (fa != NULL && fb != NULL);
+    char bufA[65536], bufB[65536];
+    while(same){
+        size_t na = fread(bufA, 1, sizeof(bufA), fa);
+        size_t nb = fread(bufB, 1, sizeof(bufB), fb);
+        same = (na == nb && memcmp(bufA, bufB, na) == 0);
+        if(na == 0) break;
+    }
+    if(fa != NULL) fclose(fa);
+    if(fb != NULL) fclose(fb);
+    return same;
+}
+
+// Reads the counters printed by llclose() on the transmitter
+void parseStatistics(const char *logPath, Run *run)
+{
+    FILE *log = fopen(logPath, "r");
+    if(log == NULL) return;
+    char line[512];
+    unsigned long long rejSent;
+    while(fgets(line, sizeof(line), log) != NULL){
+        sscanf(line, "Frames sent: %llu (%llu bytes)", &run->framesSent, &run->bytesSent);
+        sscanf(line, "Retransmissions: %llu, timeouts: %llu", &run->retransmissions, &run->timeouts);
+        sscanf(line, "REJ sent: %llu, received: %llu", &rejSent, &run->rejReceived);
+    }
+    fclose(log);
+}
+
+/**
+ * @brief Starts the cable for a bit rate, delay and bit error rate and waits until
+ * it is ready. *input is where to write its commands.
+ *
+ * @return pid of the cable, -1 on error
+ */
+pid_t startCable(int baudRate, double delayMs, double bitErrorRate, int *input)
+{
+    char cable[4200], rate[32], delay[32], ber[32], seedText[32], logPath[4200];
+    snprintf(cable, sizeof(cable), "%s/cable", binDir);
+    snprintf(rate, sizeof(rate), "%d", baudRate);
+    snprintf(delay, sizeof(delay), "%g", delayMs);
+    snprintf(ber, sizeof(ber), "%g", bitErrorRate);
+    snprintf(seedText, sizeof(seedText), "%llu", seed);
+    snprintf(logPath, sizeof(logPath), "%s/cable.log", workDir);
+    char *argv[32] = {cable, "-q", "-b", rate, "-d", delay, "-e", ber, "-s", seedText};
+    char options[256];
+    snprintf(options, sizeof(options), "%s", cableOptions);
+    int argc = 10;
+    for(char *option = strtok(options, " "); option != NULL && argc < 31; option = strtok(NULL, " "))
+        argv[argc++] = option;
+    argv[argc] = NULL;
+
+    unlink(logPath); // not to find "Cable ready" from the cable before
+    int fds[2];
+    if(pipe(fds) < 0) return -1;
+    pid_t pid = spawn(argv, logPath, fds[0], NULL);
+    close(fds[0]);
+    *input = fds[1];
+    if(pid < 0) return -1;
+
+    // "Cable ready" is printed once both ports are open
+    double deadline = nowSeconds() + 10;
+    while(nowSeconds() < deadline){
+        FILE *log = fopen(logPath, "r");
+        char line[256];
+        int ready = FALSE;
+        while(log != NULL && !ready && fgets(line, sizeof(line), log) != NULL)
+            ready = strncmp(line, "Cable ready", 11) == 0;
+        if(log != NULL) fclose(log);
+        if(ready) return pid;
+        if(waitpid(pid, NULL, WNOHANG) == pid) break;
+        usleep(50000);
+    }
+    fprintf(stderr, "Cable did not start, see %s\n", logPath);
+    kill(pid, SIGKILL);
+    close(*input);
+    return -1;
+}
+
+void stopCable(pid_t pid, int input)
+{
+    if(write(input, "end\n", 4) < 0) perror("cable");
+    close(input);
+    waitFor(pid, 5);
+}
+
+// Transfers file once through the cable already running
+void runTransfer(const char *file, Run *run)
+{
+    char program[4200], received[4200], journal[4300], txLog[4200], rxLog[4200];
+    char payload[32], window[32];
+    snprintf(program, sizeof(program), "%s/main", binDir);
+    snprintf(received, sizeof(received), "%s/received", workDir);
+    snprintf(journal, sizeof(journal), "%s.journal", received);
+    snprintf(txLog, sizeof(txLog), "%s/%d-tx.log", workDir, run->index);
+    snprintf(rxLog, sizeof(rxLog), "%s/%d-rx.log", workDir, run->index);
+    snprintf(payload, sizeof(payload), "%d", run->maxPayload);
+    snprintf(window, sizeof(window), "%d", run->window);
+    // every run starts from scratch, never resuming the one before
+    unlink(received);
+    unlink(journal);
+
+    const char *env[] = {"LL_ARQ", (run->window > 1) ? arq : "sw",
+                         "LL_WINDOW", window, "LL_MAX_PAYLOAD", payload, NULL};
+    char *const rxArgv[] = {program, RX_PORT, "rx", received, NULL};
+    char *const txArgv[] = {program, TX_PORT, "tx", (char *)file, NULL};
+
+    pid_t rx = spawn(rxArgv, rxLog, -1, NULL);
+    usleep(200000); // receiver waiting for SET
+    double start = nowSeconds();
+    pid_t tx = spawn(txArgv, txLog, -1, env);
+    run->completed = waitFor(tx, runTimeout);
+    run->seconds = nowSeconds() - start;
+    waitFor(rx, run->completed ? 10 : 0);
+
+    struct stat st;
+    stat(file, &st);
+    run->identical = run->completed && sameFiles(file, received);
+    run->throughput = run->identical ? st.st_size * 8 / run->seconds : 0;
+    run->efficiency = (run->baudRate > 0) ? run->throughput / run->baudRate : 0;
+    parseStatistics(txLog, run);
+}
+
+void writeCsvHeader(FILE *csv)
+{
+    fprintf(csv, "baud_rate,delay_ms,max_payload,window,bit_error_rate,completed,identical,"
+                 "seconds,throughput_bps,efficiency,frames_sent,bytes_sent,"
+                 "retransmissions,timeouts,rej_received\n");
+}
+
+void writeCsv(FILE *csv, const Run *run)
+{
+    fprintf(csv, "%d,%g,%d,%d,%g,%d,%d,%.3f,%.0f,%.4f,%llu,%llu,%llu,%llu,%llu\n",
+            run->baudRate, run->delayMs, run->maxPayload, run->window, run->bitErrorRate,
+            run->completed, run->identical, run->seconds, run->throughput,
+            run->efficiency, run->framesSent, run->bytesSent,
+            run->retransmissions, run->timeouts, run->rejReceived);
+    fflush(csv);
+}
+
+void writeJson(FILE *json, const Run *run, int first)
+{
+    fprintf(json, "%s\n  {\"baud_rate\": %d, \"delay_ms\": %g, \"max_payload\": %d, \"window\": %d, "
+                  "\"bit_error_rate\": %g, \"completed\": %s, \"identical\": %s, "
+                  "\"seconds\": %.3f, \"throughput_bps\": %.0f, \"efficiency\": %.4f, "
+                  "\"frames_sent\": %llu, \"bytes_sent\": %llu, \"retransmissions\": %llu, "
+                  "\"timeouts\": %llu, \"rej_received\": %llu}",
+            first ? "" : ",", run->baudRate, run->delayMs, run->maxPayload, run->window,
+            run->bitErrorRate, run->completed ? "true" : "false",
+            run->identical ? "true" : "false", run->seconds, run->throughput,
+            run->efficiency, run->framesSent, run->bytesSent,
+            run->retransmissions, run->timeouts, run->rejReceived);
+    fflush(json);
+}
+
+/**
+ * @brief Starts the cable with the settings of line and transfers the file
+ * with every maximum payload and window through it. runs counts transfers.
+ *
+ * @return -1 if the cable did not start
+ */
+int sweepLine(Run line, const List *payloads, const List *windows, const char *file,
+              FILE *csv, FILE *json, int *runs)
+{
+    int input;
+    pid_t cable = startCable(line.baudRate, line.delayMs, line.bitErrorRate, &input);
+    if(cable < 0) return -1;
+    for(int p = 0; p < payloads->count; p++){
+        for(int w = 0; w < windows->count; w++){
+            Run run = line;
+            run.index = (*runs)++;
+            run.maxPayload = payloads->values[p];
+            run.window = windows->values[w];
+            runTransfer(file, &run);
+            writeCsv(csv, &run);
+            writeCsv(stdout, &run);
+            writeJson(json, &run, run.index == 0);
+        }
+    }
+    stopCable(cable, input);
+    return 0;
+}
+
+void usage(const char *program)
+{
+    printf("Usage: %s [-f file] [-b rates] [-d delays] [-p payloads] [-w windows]\n"
+           "          [-e bers] [-a gbn|sr] [-s seed] [-t seconds] [-c csv] [-j json]\n"
+           "          [-o cable options]\n", program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *file = "penguin.gif";
+    const char *csvPath = "bench.csv";
+    const char *jsonPath = "bench.json";
+    List rates, delays, payloads, windows, bers;
+    parseList("38400,115200", &rates);
+    parseList("0", &delays);
+    parseList("1000,4000,16000", &payloads);
+    parseList("1,7", &windows);
+    parseList("0,1e-5,1e-4", &bers);
+
+    int option;
+    while((option = getopt(argc, argv, "f:b:d:p:w:e:a:s:t:c:j:o:")) != -1){
+        switch(option){
+            case 'f': file = optarg; break;
+            case 'b': parseList(optarg, &rates); break;
+            case 'd': parseList(optarg, &delays); break;
+            case 'p': parseList(optarg, &payloads); break;
+            case 'w': parseList(optarg, &windows); break;
+            case 'e': parseList(optarg, &bers); break;
+            case 'a': arq = optarg; break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 't': runTimeout = atoi(optarg); break;
+            case 'c': csvPath = optarg; break;
+            case 'j': jsonPath = optarg; break;
+            case 'o': cableOptions = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    // main and cable are next to this program
+    snprintf(binDir, sizeof(binDir), "%s", argv[0]);
+    char *slash = strrchr(binDir, '/');
+    if(slash != NULL) *slash = '\0';
+    else strcpy(binDir, ".");
+    // the transmitter runs in this directory, it must find the file from anywhere
+    char filePath[4096];
+    if(realpath(file, filePath) == NULL){
+        perror(file);
+        return 1;
+    }
+    if(mkdtemp(workDir) == NULL){
+        perror("mkdtemp");
+        return 1;
+    }
+
+    FILE *csv = fopen(csvPath, "w");
+    FILE *json = fopen(jsonPath, "w");
+    if(csv == NULL || json == NULL){
+        perror("bench output");
+        return 1;
+    }
+    writeCsvHeader(csv);
+    writeCsvHeader(stdout);
+    fprintf(json, "[");
+
+    int runs = 0;
+    for(int r = 0; r < rates.count; r++){
+        for(int d = 0; d < delays.count; d++){
+            for(int e = 0; e < bers.count; e++){
+                Run line = {0};
+                line.baudRate = rates.values[r];
+                line.delayMs = delays.values[d];
+                line.bitErrorRate = bers.values[e];
+                if(sweepLine(line, &payloads, &windows, filePath, csv, json, &runs) < 0) return 1;
+            }
+        }
+    }
+    fprintf(json, "\n]\n");
+    fclose(csv);
+    fclose(json);
+    printf("Results in %s and %s, logs of every run in %s\n", csvPath, jsonPath, workDir);
+    return 0;
+}
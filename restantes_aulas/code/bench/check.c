@@ -0,0 +1,504 @@
+// Hot path correctness check.
+// Compares byte stuffing as the link layer runs it (SIMD when the CPU has
+// it) and its portable scalar version with a plain byte-by-byte encoder,
+// on random data of every tail length and of random lengths and
+// alignments, some of it dense in FLAG and ESC.
+// Checks the CRCs against their published check values, and the CRCs the
+// link layer runs (tables, SSE4.2 for CRC-32C when the CPU has it) and the
+// tables alone against a bit-by-bit reference. Round-trips Reed-Solomon
+// blocks with as many byte errors as they correct, and more, rebuilds
+// erasure-coded groups from every pattern of losses they cover, and
+// round-trips LZ blocks, feeding the decoder truncated and corrupt ones too.
+// Stops at the first difference and exits with status 1.
+//
+// Usage: check [rounds]
+
+#include "byte_stuffing.h"
+#include "compression.h"
+#include "erasure_code.h"
+#include "frame_check.h"
+#include "reed_solomon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAG 0x7E
+#define ESC 0x7D
+#define MAX_SIZE 8192
+#define MAX_OFFSET 64 // misalignment of the data
+
+unsigned char buffer[MAX_SIZE + MAX_OFFSET];
+unsigned char expected[STUFFED_BOUND(MAX_SIZE)];
+unsigned char actual[STUFFED_BOUND(MAX_SIZE)];
+unsigned char encoded[RS_ENCODED_BOUND(MAX_SIZE)];
+
+#define MAX_PACKET 64 // erasure-coded packets, longer ones only cost time
+unsigned char groupPackets[ERASURE_MAX_GROUP][MAX_PACKET];
+unsigned char groupRepairs[ERASURE_MAX_REPAIR][MAX_PACKET];
+
+#define GUARD 64 // bytes past the output the decoder must leave alone
+unsigned char compressed[STUFFED_BOUND(MAX_SIZE)];
+long lzStored = 0; // blocks the pipeline would store uncompressed
+
+// Random bytes, a share special of them FLAG or ESC
+void fill(unsigned char *data, int size, int special)
+{
+    for(int i = 0; i < size; i++){
+        if(rand() % 100 < special) data[i] = (rand() & 1) ? FLAG : ESC;
+        else data[i] = rand();
+    }
+}
+
+void dump(const char *name, const unsigned char *bytes, int size)
+{
+    printf("%s (%d):", name, size);
+    for(int i = 0; i < size && i < 96; i++) printf(" %02x", bytes[i]);
+    printf(size > 96 ? " ...\n" : "\n");
+}
+
+// Reference encoder, the data field loop of the original llwrite(): ESC
+// goes in front of every FLAG and ESC, and BCC2 (XOR of the data) is
+// appended, escaped the same way. Shares no code with byte_stuffing.c.
+int stuffReference(unsigned char *dst, const unsigned char *data, int size)
+{
+    unsigned char BCC2 = 0;
+    int n = 0;
+    for(int i = 0; i <= size; i++){
+        unsigned char byte = (i < size) ? data[i] : BCC2;
+        switch(byte){
+            case FLAG:
+                dst[n++] = ESC;
+                dst[n++] = FLAG;
+                break;
+            case ESC:
+                dst[n++] = ESC;
+                dst[n++] = ESC;
+                break;
+            default:
+                dst[n++] = byte;
+        }
+        if(i < size) BCC2 ^= byte;
+    }
+    return n;
+}
+
+// Return 0 if stuffData(), stuffDataScalar() and stuffBytes() agree with
+// stuffReference() on data, 1 (after printing it) otherwise
+int checkStuffing(const unsigned char *data, int size)
+{
+    int expectedSize = stuffReference(expected, data, size);
+    struct
+    {
+        const char *name;
+        int (*stuff)(unsigned char *, const unsigned char *, int);
+    } versions[] = {
+        {"stuffData", stuffData},
+        {"stuffDataScalar", stuffDataScalar},
+    };
+    for(int v = 0; v < 2; v++){
+        int actualSize = versions[v].stuff(actual, data, size);
+        if(actualSize != expectedSize || memcmp(actual, expected, expectedSize) != 0){
+            printf("%s() differs from the reference on %d bytes\n", versions[v].name, size);
+            dump("data", data, size);
+            dump("reference", expected, expectedSize);
+            dump(versions[v].name, actual, actualSize);
+            return 1;
+        }
+    }
+
+    // stuffBytes() is the same without BCC2, which it returns instead
+    unsigned char bcc = 0, BCC2;
+    for(int i = 0; i < size; i++) bcc ^= data[i];
+    int bodySize = expectedSize - ((bcc == FLAG || bcc == ESC) ? 2 : 1);
+    int actualSize = stuffBytes(actual, data, size, &BCC2);
+    if(actualSize != bodySize || memcmp(actual, expected, bodySize) != 0 || BCC2 != bcc){
+        printf("stuffBytes() differs from the reference on %d bytes (BCC2 %02x, expected %02x)\n",
+               size, BCC2, bcc);
+        dump("data", data, size);
+        dump("stuffBytes", actual, actualSize);
+        return 1;
+    }
+    return 0;
+}
+
+// Reference CRC, one bit at a time: reflected poly, register starting at
+// mask and XORed with it at the end (CRC-16/X.25 and CRC-32C both are)
+unsigned int crcBitwise(unsigned int poly, unsigned int mask, const unsigned char *data, int size)
+{
+    unsigned int crc = mask;
+    for(int i = 0; i < size; i++){
+        crc ^= data[i];
+        for(int bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+    }
+    return crc ^ mask;
+}
+
+#define crc16Bitwise(data, size) crcBitwise(0x8408, 0xFFFF, data, size)
+#define crc32cBitwise(data, size) crcBitwise(0x82F63B78, 0xFFFFFFFF, data, size)
+
+// Return 0 if both CRCs of "123456789" are the catalogued check values
+// (CRC-16/X.25 0x906E, CRC-32C 0xE3069283), 1 otherwise
+int checkKnownAnswers()
+{
+    const unsigned char *digits = (const unsigned char *)"123456789";
+    struct
+    {
+        const char *name;
+        unsigned int value, expected;
+    } answers[] = {
+        {"crc16", fcsCompute(FcsCrc16, digits, 9), 0x906E},
+        {"crc16 table", crc16Table(digits, 9), 0x906E},
+        {"crc16 bitwise", crc16Bitwise(digits, 9), 0x906E},
+        {"crc32c", fcsCompute(FcsCrc32c, digits, 9), 0xE3069283},
+        {"crc32c table", crc32cTable(digits, 9), 0xE3069283},
+        {"crc32c bitwise", crc32cBitwise(digits, 9), 0xE3069283},
+    };
+    for(int i = 0; i < 6; i++){
+        if(answers[i].value != answers[i].expected){
+            printf("%s of \"123456789\" is %08X, expected %08X\n",
+                   answers[i].name, answers[i].value, answers[i].expected);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Return 0 if the CRCs of data, from the tables and as the link layer
+// computes them whole and in two parts, match the bitwise reference,
+// 1 (after printing it) otherwise
+int checkCrcs(const unsigned char *data, int size)
+{
+    int split = (size > 0) ? rand() % (size + 1) : 0;
+    unsigned int crc16 = crc16Bitwise(data, size), crc32 = crc32cBitwise(data, size);
+    struct
+    {
+        const char *name;
+        unsigned int value, expected;
+    } crcs[] = {
+        {"crc16 table", crc16Table(data, size), crc16},
+        {"crc16", fcsCompute(FcsCrc16, data, size), crc16},
+        {"crc16 split in two",
+         fcsUpdate(FcsCrc16, fcsCompute(FcsCrc16, data, split), data + split, size - split), crc16},
+        {"crc32c table", crc32cTable(data, size), crc32},
+        {"crc32c", fcsCompute(FcsCrc32c, data, size), crc32},
+        {"crc32c split in two",
+         fcsUpdate(FcsCrc32c, fcsCompute(FcsCrc32c, data, split), data + split, size - split), crc32},
+    };
+    for(int i = 0; i < 6; i++){
+        if(crcs[i].value != crcs[i].expected){
+            printf("%s of %d bytes is %08X, the bitwise reference gives %08X\n",
+                   crcs[i].name, size, crcs[i].value, crcs[i].expected);
+            dump("data", data, size);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Puts count byte errors at distinct random positions of a block of size
+// bytes
+void corrupt(unsigned char *block, int size, int count)
+{
+    int positions[RS_BLOCK];
+    for(int i = 0; i < size; i++) positions[i] = i;
+    for(int i = 0; i < count; i++){
+        int j = i + rand() % (size - i);
+        int t = positions[i]; positions[i] = positions[j]; positions[j] = t;
+        block[positions[i]] ^= 1 + rand() % 255;
+    }
+}
+
+// Encodes data with parity bytes per block, adds up to parity / 2 byte
+// errors to every block and parity / 2 + extra to one of them, and decodes.
+// Return 0 if the errors were corrected, or the block with too many of
+// them rejected, 1 (after printing it) otherwise
+int checkReedSolomon(int parity, const unsigned char *data, int size, int extra)
+{
+    int encodedSize = rsEncode(parity, data, size, encoded);
+    int blocks = (encodedSize + RS_BLOCK - 1) / RS_BLOCK;
+    int over = (extra > 0) ? rand() % blocks : -1, errors = 0;
+    for(int b = 0; b < blocks; b++){
+        int blockSize = (b == blocks - 1) ? encodedSize - b * RS_BLOCK : RS_BLOCK;
+        int count = (b == over) ? parity / 2 + extra : rand() % (parity / 2 + 1);
+        if(count > blockSize) count = blockSize;
+        corrupt(encoded + b * RS_BLOCK, blockSize, count);
+        errors += count;
+    }
+    int corrected, decodedSize = rsDecode(parity, encoded, encodedSize, &corrected);
+    if(over >= 0){
+        if(decodedSize < 0) return 0;
+        printf("rsDecode() with %d parity bytes missed %d byte errors in block %d of %d bytes\n",
+               parity, parity / 2 + extra, over, size);
+        return 1;
+    }
+    if(decodedSize != size || memcmp(encoded, data, size) != 0 || corrected != errors){
+        printf("rsDecode() with %d parity bytes on %d bytes with %d byte errors returned %d, "
+               "%d corrected\n", parity, size, errors, decodedSize, corrected);
+        dump("data", data, size);
+        if(decodedSize > 0) dump("decoded", encoded, decodedSize);
+        return 1;
+    }
+    return 0;
+}
+
+// Rebuilds the group of n packets with k repairs from what is left after
+// losing the packets and repairs listed in lost (repairs numbered from n).
+// Return the result of erasureRebuild(), -2 (after printing it) if it
+// reported success with a packet rebuilt wrong
+int rebuildGroup(int n, int k, const int lost[], int count, int size)
+{
+    static unsigned char received[ERASURE_MAX_GROUP][MAX_PACKET];
+    static unsigned char scratch[ERASURE_MAX_REPAIR][MAX_PACKET];
+    unsigned char *packets[ERASURE_MAX_GROUP], *repairsLeft[ERASURE_MAX_REPAIR];
+    int present[ERASURE_MAX_GROUP + ERASURE_MAX_REPAIR], index[ERASURE_MAX_REPAIR], left = 0;
+    for(int i = 0; i < n + k; i++) present[i] = 1;
+    for(int c = 0; c < count; c++) present[lost[c]] = 0;
+    for(int i = 0; i < n; i++){
+        // lost packets start as garbage, the rebuild must overwrite them
+        if(present[i]) memcpy(received[i], groupPackets[i], size);
+        else memset(received[i], 0xA5, size);
+        packets[i] = received[i];
+    }
+    for(int j = 0; j < k; j++){
+        if(!present[n + j]) continue;
+        memcpy(scratch[left], groupRepairs[j], size);
+        repairsLeft[left] = scratch[left];
+        index[left++] = j;
+    }
+    int result = erasureRebuild(k, n, packets, present, repairsLeft, index, left, size);
+    for(int i = 0; i < n && result == 0; i++){
+        if(memcmp(received[i], groupPackets[i], size) != 0){
+            printf("erasureRebuild() of %d packets with %d repairs got packet %d wrong, lost:", n, k, i);
+            for(int c = 0; c < count; c++) printf(" %d", lost[c]);
+            printf("\n");
+            dump("packet", groupPackets[i], size);
+            dump("rebuilt", received[i], size);
+            return -2;
+        }
+    }
+    return result;
+}
+
+// Builds the k repairs of a group of n random packets of random sizes, then
+// rebuilds the group after every loss of at most k of the n + k packets and
+// checks that losing k + 1 of the packets is refused.
+// Return the number of loss patterns rebuilt, -1 (after printing it) on
+// any failure
+long checkErasure(int n, int k)
+{
+    int size = 0;
+    memset(groupPackets, 0, sizeof(groupPackets));
+    memset(groupRepairs, 0, sizeof(groupRepairs));
+    for(int i = 0; i < n; i++){
+        int packetSize = 1 + rand() % MAX_PACKET;
+        fill(groupPackets[i], packetSize, 10);
+        if(packetSize > size) size = packetSize;
+        for(int j = 0; j < k; j++) erasureAdd(k, j, i, groupRepairs[j], groupPackets[i], packetSize);
+    }
+
+    long patterns = 0;
+    int lost[ERASURE_MAX_REPAIR + 1];
+    for(int count = 0; count <= k; count++){
+        // every combination of count of the n + k, in lexicographic order
+        for(int c = 0; c < count; c++) lost[c] = c;
+        for(;;){
+            int result = rebuildGroup(n, k, lost, count, size);
+            if(result == -2) return -1;
+            if(result < 0){
+                printf("erasureRebuild() of %d packets with %d repairs failed with %d lost\n", n, k, count);
+                return -1;
+            }
+            patterns++;
+            int c = count - 1;
+            while(c >= 0 && lost[c] == n + k - count + c) c--;
+            if(c < 0) break;
+            lost[c]++;
+            for(int d = c + 1; d < count; d++) lost[d] = lost[d - 1] + 1;
+        }
+    }
+    if(n > k){
+        for(int c = 0; c <= k; c++) lost[c] = c;
+        if(rebuildGroup(n, k, lost, k + 1, size) != -1){
+            printf("erasureRebuild() of %d packets with %d repairs did not refuse %d lost\n", n, k, k + 1);
+            return -1;
+        }
+    }
+    return patterns;
+}
+
+// Data that compresses: kind 0 is runs of one byte, 1 a short pattern
+// repeated, 2 words as in text
+void fillCompressible(unsigned char *data, int size, int kind)
+{
+    const char *words[] = {"frame ", "link ", "layer ", "window ", "\x7e", "\x7d", "data "};
+    int period = 1 + rand() % 16;
+    for(int i = 0; i < size; ){
+        if(kind == 0){
+            unsigned char byte = rand();
+            for(int run = 1 + rand() % 300; run > 0 && i < size; run--) data[i++] = byte;
+        }
+        else if(kind == 1){
+            data[i] = (i < period) ? rand() : data[i - period];
+            i++;
+        }
+        else{
+            const char *word = words[rand() % 7];
+            for(int j = 0; word[j] != '\0' && i < size; j++) data[i++] = word[j];
+        }
+    }
+}
+
+// Decompresses size bytes of compressed into actual with room for
+// capacity bytes, followed by GUARD bytes it must not touch.
+// Return the decompressed size, -2 if it wrote past capacity
+int decompressGuarded(int size, int capacity)
+{
+    memset(actual + capacity, 0xA5, GUARD);
+    int n = lzDecompress(compressed, size, actual, capacity);
+    for(int i = 0; i < GUARD; i++){
+        if(actual[capacity + i] != 0xA5) return -2;
+    }
+    return n;
+}
+
+// Return 0 if data compresses and decompresses back to itself, and the
+// decoder keeps to its bounds on the block truncated at random points,
+// with a byte changed and with too small an output, 1 (after printing it)
+// otherwise
+int checkCompression(const unsigned char *data, int size)
+{
+    int compressedSize = lzCompress(data, size, compressed, sizeof(compressed));
+    int n = (compressedSize >= 0) ? decompressGuarded(compressedSize, size) : -1;
+    if(n != size || memcmp(actual, data, size) != 0){
+        printf("LZ round trip of %d bytes compressed to %d gives %d\n", size, compressedSize, n);
+        dump("data", data, size);
+        if(n > 0) dump("decompressed", actual, n);
+        return 1;
+    }
+
+    // the pipeline stores the block as it is unless it compresses into
+    // size - 1 bytes, and lzCompress() must say so without overflowing
+    if(size > 0){
+        memset(actual + size - 1, 0xA5, GUARD);
+        int fitted = lzCompress(data, size, actual, size - 1);
+        int overflow = 0;
+        for(int i = 0; i < GUARD; i++) overflow |= actual[size - 1 + i] != 0xA5;
+        if(overflow || (fitted >= 0 && (fitted != compressedSize ||
+                                        memcmp(actual, compressed, fitted) != 0))){
+            printf("lzCompress() of %d bytes into %d %s\n", size, size - 1,
+                   overflow ? "wrote past the end" : "differs from the unbounded one");
+            return 1;
+        }
+        if(fitted < 0) lzStored++;
+        if(decompressGuarded(compressedSize, size - 1) != -1){
+            printf("lzDecompress() of %d bytes fit in %d\n", size, size - 1);
+            return 1;
+        }
+    }
+
+    // truncated, the decoder may stop at a sequence it has whole: what it
+    // gives back is then the start of the data
+    for(int i = 0; i < 16 && compressedSize > 0; i++){
+        int cut = rand() % compressedSize;
+        n = decompressGuarded(cut, size);
+        if(n < -1 || n > size || (n > 0 && memcmp(actual, data, n) != 0)){
+            printf("lzDecompress() of %d bytes truncated to %d of %d gives %d\n",
+                   size, cut, compressedSize, n);
+            return 1;
+        }
+    }
+
+    // corrupt, anything may come out as long as it stays in bounds
+    for(int i = 0; i < 16 && compressedSize > 0; i++){
+        int at = rand() % compressedSize;
+        unsigned char original = compressed[at];
+        compressed[at] ^= 1 + rand() % 255;
+        n = decompressGuarded(compressedSize, size);
+        compressed[at] = original;
+        if(n < -1 || n > size){
+            printf("lzDecompress() of %d bytes with byte %d of %d changed gives %d\n",
+                   size, at, compressedSize, n);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 200;
+    const int specials[] = {0, 1, 10, 50, 100}; // % of FLAG/ESC bytes
+    int n = sizeof(specials) / sizeof(specials[0]);
+    long checks = 0;
+    srand(1);
+
+    if(checkKnownAnswers()) return 1;
+    for(int round = 0; round < rounds; round++){
+        for(int s = 0; s < n; s++){
+            // every tail after the last full vector
+            for(int size = 0; size < 64; size++){
+                unsigned char *data = buffer + rand() % MAX_OFFSET;
+                fill(data, size, specials[s]);
+                if(checkStuffing(data, size) || checkCrcs(data, size)) return 1;
+                checks++;
+            }
+            int size = rand() % (MAX_SIZE + 1);
+            unsigned char *data = buffer + rand() % MAX_OFFSET;
+            fill(data, size, specials[s]);
+            if(checkStuffing(data, size) || checkCrcs(data, size)) return 1;
+            checks++;
+        }
+    }
+
+    // Reed-Solomon: up to parity / 2 errors per block are corrected. With
+    // more, a decoder may land on another codeword; the odds are below
+    // 1 / (parity / 2)! a block, so rejection is only required from 16
+    // parity bytes on, and the fixed seed keeps the run repeatable.
+    const int parities[] = {2, 4, 8, 16, 32};
+    long blocks = 0, rejected = 0;
+    for(int round = 0; round < rounds; round++){
+        for(int p = 0; p < 5; p++){
+            int size = 1 + rand() % MAX_SIZE;
+            fill(buffer, size, 10);
+            if(checkReedSolomon(parities[p], buffer, size, 0)) return 1;
+            blocks += (size + RS_BLOCK - parities[p] - 1) / (RS_BLOCK - parities[p]);
+            if(parities[p] >= 16){
+                if(checkReedSolomon(parities[p], buffer, size, 1 + rand() % (parities[p] / 2))) return 1;
+                rejected++;
+            }
+        }
+    }
+
+    // erasure code: every loss pattern the repairs cover
+    const int groups[][2] = {{1, 1}, {2, 1}, {7, 1}, {4, 2}, {6, 3}, {10, 4}, {16, 4}, {8, 6},
+                             {1, ERASURE_MAX_REPAIR}, {ERASURE_MAX_GROUP, 1}, {ERASURE_MAX_GROUP, 2}};
+    long patterns = 0;
+    for(int g = 0; g < 11; g++){
+        long rebuilt = checkErasure(groups[g][0], groups[g][1]);
+        if(rebuilt < 0) return 1;
+        patterns += rebuilt;
+    }
+
+    // LZ: random data (stored by the pipeline) and data that compresses
+    long blocksLz = 0;
+    for(int round = 0; round < rounds; round++){
+        for(int kind = -1; kind < 3; kind++){
+            for(int size = 0; size <= 64; size++){
+                // every short size, then one up to MAX_SIZE
+                int blockSize = (size < 64) ? size : rand() % (MAX_SIZE + 1);
+                if(kind < 0) fill(buffer, blockSize, 10);
+                else fillCompressible(buffer, blockSize, kind);
+                if(checkCompression(buffer, blockSize)) return 1;
+                blocksLz++;
+            }
+        }
+    }
+
+    printf("stuffing: %ld inputs, SIMD and scalar agree with the reference\n", checks);
+    printf("check values: known answers match, %ld inputs agree with the bitwise reference\n", checks);
+    printf("reed-solomon: %ld blocks corrected, %ld with too many errors rejected\n", blocks, rejected);
+    printf("erasure code: %ld loss patterns rebuilt\n", patterns);
+    printf("lz: %ld blocks round-tripped (%ld stored), truncated and corrupt ones kept in bounds\n",
+           blocksLz, lzStored);
+    return 0;
+}
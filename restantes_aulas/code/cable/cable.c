@@ -1,16 +1,21 @@
 // Virtual cable program to test serial port.
 // Creates a pair of virtual Tx / Rx serial ports using "socat".
+// Options set the bit rate and propagation delay of the line and the errors
+// added to it (see ErrorModel), so the cable can also be run unattended
+// (see bench/bench.c).
 //
 // Author: Manuel Ricardo [mricardo@fe.up.pt]
 // Modified by: Eduardo Nuno Almeida [enalmeida@fe.up.pt]
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 // Baudrate settings are defined in <asm/termbits.h>, which is
@@ -21,6 +26,260 @@
 #define TRUE 1
 
 #define BUF_SIZE 2048
+#define BITS_PER_BYTE 10 // 8N1: start bit, 8 data bits, stop bit
+#define PACING_MS 2      // most time a chunk keeps the line busy
+#define QUEUE_CHUNKS 512 // chunks on the wire in each direction
+
+// Error model of the line: bit errors at a uniform rate or in
+// Gilbert-Elliott bursts, byte drops and insertions, and loss or
+// duplication of whole chunks (the bytes of one read from a port). Each
+// kind of error draws from its own generator, seeded from the cable's seed,
+// so the errors hitting a given byte of the stream are the same on every
+// run whatever the chunks read. Chunk loss and duplication act on the
+// chunks, so they also depend on the timing of the reads.
+typedef struct
+{
+    double bitErrorRate;    // every bit, or in the good state of Gilbert-Elliott
+    // Gilbert-Elliott: per bit probabilities of going from the good state to
+    // the bad one and back (0 disables), and the bit error rate while bad
+    double toBad;
+    double toGood;
+    double badBitErrorRate;
+    double dropRate;        // per byte
+    double insertRate;      // per byte, a random byte is inserted after it
+    double chunkLossRate;
+    double duplicateRate;   // per chunk, it arrives twice
+} ErrorModel;
+
+typedef enum
+{
+    RandomBits,
+    RandomState,
+    RandomDrop,
+    RandomInsert,
+    RandomChunk,
+    N_RANDOM,
+} RandomStream;
+
+// Errors of one direction of the cable
+typedef struct
+{
+    const ErrorModel *model;
+    unsigned long long random[N_RANDOM]; // xorshift64* states
+    int bad;              // Gilbert-Elliott state
+    long long stateLeft;  // bits until the state changes, -1 to draw
+    long long nextError;  // bits until the next bit error, -1 to draw
+    long long nextDrop;   // bytes until the next drop, -1 to draw
+    long long nextInsert; // bytes until the next insertion, -1 to draw
+
+    unsigned long long bitErrors;
+    unsigned long long drops;
+    unsigned long long inserts;
+    unsigned long long chunksLost;
+    unsigned long long duplicates;
+} ErrorChannel;
+
+// splitmix64, to spread one seed over the generators
+static unsigned long long mix(unsigned long long x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// xorshift64*
+static unsigned long long nextRandom(ErrorChannel *channel, RandomStream stream)
+{
+    unsigned long long x = channel->random[stream];
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    channel->random[stream] = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in (0, 1)
+static double randomUnit(ErrorChannel *channel, RandomStream stream)
+{
+    return ((nextRandom(channel, stream) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// Natural logarithm of x > 0, so the cable links against libc alone:
+// x = m 2^e with m in [sqrt(2)/2, sqrt(2)), and ln m = 2 atanh((m-1)/(m+1))
+static double naturalLog(double x)
+{
+    union
+    {
+        double value;
+        unsigned long long bits;
+    } u = {x};
+    int e = (int)((u.bits >> 52) & 0x7FF) - 1023;
+    u.bits = (u.bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+    double m = u.value;
+    if (m > 1.4142135623730951)
+    {
+        m /= 2;
+        e++;
+    }
+    double t = (m - 1) / (m + 1), t2 = t * t, term = t, sum = 0;
+    for (int k = 1; k < 40; k += 2)
+    {
+        sum += term / k;
+        term *= t2;
+    }
+    return 2 * sum + e * 0.6931471805599453;
+}
+
+// Trials before the next one with probability p (geometric distribution),
+// so errors cost per error and not per bit
+static long long gap(ErrorChannel *channel, RandomStream stream, double p)
+{
+    if (p >= 1)
+        return 0;
+    return (long long)(naturalLog(randomUnit(channel, stream)) / naturalLog(1 - p));
+}
+
+// Starts a direction with the errors of model, which must outlive it
+static void errorInit(ErrorChannel *channel, const ErrorModel *model, unsigned long long seed)
+{
+    memset(channel, 0, sizeof(*channel));
+    channel->model = model;
+    for (int i = 0; i < N_RANDOM; i++)
+    {
+        channel->random[i] = mix(seed * N_RANDOM + i);
+        if (channel->random[i] == 0)
+            channel->random[i] = 1; // xorshift would stay at 0
+    }
+    channel->stateLeft = -1;
+    channel->nextError = -1;
+    channel->nextDrop = -1;
+    channel->nextInsert = -1;
+}
+
+// Return TRUE if the next chunk is lost
+static int errorChunkLost(ErrorChannel *channel)
+{
+    if (channel->model->chunkLossRate <= 0 ||
+        randomUnit(channel, RandomChunk) >= channel->model->chunkLossRate)
+        return FALSE;
+    channel->chunksLost++;
+    return TRUE;
+}
+
+// Return TRUE if the next chunk is to arrive twice
+static int errorDuplicate(ErrorChannel *channel)
+{
+    if (channel->model->duplicateRate <= 0 ||
+        randomUnit(channel, RandomChunk) >= channel->model->duplicateRate)
+        return FALSE;
+    channel->duplicates++;
+    return TRUE;
+}
+
+// Flip bits in [bit, end) at the bit error rate ber
+static void flipBits(ErrorChannel *channel, unsigned char *buf, long long bit, long long end, double ber)
+{
+    while (ber > 0)
+    {
+        if (channel->nextError < 0)
+            channel->nextError = gap(channel, RandomBits, ber);
+        if (bit + channel->nextError >= end)
+        {
+            channel->nextError -= end - bit;
+            return;
+        }
+        bit += channel->nextError;
+        buf[bit / 8] ^= 1 << (bit % 8);
+        channel->bitErrors++;
+        bit++;
+        channel->nextError = -1;
+    }
+}
+
+// Bit errors of the whole buffer, split where the Gilbert-Elliott state
+// changes
+static void addBitErrors(ErrorChannel *channel, unsigned char *buf, int size)
+{
+    const ErrorModel *model = channel->model;
+    int bursts = model->toBad > 0;
+    long long bits = (long long)size * 8;
+    long long bit = 0;
+    while (bit < bits)
+    {
+        long long end = bits;
+        if (bursts)
+        {
+            if (channel->stateLeft < 0)
+                channel->stateLeft = gap(channel, RandomState, channel->bad ? model->toGood : model->toBad) + 1;
+            if (bit + channel->stateLeft < end)
+                end = bit + channel->stateLeft;
+        }
+        flipBits(channel, buf, bit, end, channel->bad ? model->badBitErrorRate : model->bitErrorRate);
+        if (bursts)
+        {
+            channel->stateLeft -= end - bit;
+            if (channel->stateLeft == 0)
+            {
+                channel->bad = !channel->bad;
+                channel->stateLeft = -1;
+                channel->nextError = -1; // the other state has its own rate
+            }
+        }
+        bit = end;
+    }
+}
+
+// Return TRUE if the event of probability p counted down in *next happens
+// at this byte
+static int byteEvent(ErrorChannel *channel, RandomStream stream, double p, long long *next)
+{
+    if (p <= 0)
+        return FALSE;
+    if (*next < 0)
+        *next = gap(channel, stream, p);
+    if ((*next)-- > 0)
+        return FALSE;
+    *next = -1;
+    return TRUE;
+}
+
+// Flips bits of the size bytes in buf, then drops and inserts bytes. buf
+// holds capacity bytes, insertions that do not fit are skipped.
+// Return the new size.
+static int errorApply(ErrorChannel *channel, unsigned char *buf, int size, int capacity)
+{
+    const ErrorModel *model = channel->model;
+    addBitErrors(channel, buf, size);
+    if (model->dropRate <= 0 && model->insertRate <= 0)
+        return size;
+
+    unsigned char out[capacity];
+    int n = 0;
+    for (int i = 0; i < size; i++)
+    {
+        if (byteEvent(channel, RandomDrop, model->dropRate, &channel->nextDrop))
+            channel->drops++;
+        else if (n < capacity)
+            out[n++] = buf[i];
+        if (byteEvent(channel, RandomInsert, model->insertRate, &channel->nextInsert) && n < capacity)
+        {
+            out[n++] = nextRandom(channel, RandomInsert) >> 56;
+            channel->inserts++;
+        }
+    }
+    memcpy(buf, out, n);
+    return n;
+}
+
+// Prints the errors added so far
+static void errorPrint(const ErrorChannel *channel, const char *name)
+{
+    printf("%s: %llu bits flipped, %llu bytes dropped, %llu inserted, "
+           "%llu chunks lost, %llu duplicated\n",
+           name, channel->bitErrors, channel->drops, channel->inserts,
+           channel->chunksLost, channel->duplicates);
+}
 
 typedef enum
 {
@@ -29,6 +288,40 @@ typedef enum
     CableModeNoise,
 } CableMode;
 
+// Bytes read from one port together, on their way to the other
+typedef struct
+{
+    double arrival; // ms, when the last byte reaches the other end
+    int size;
+    unsigned char data[BUF_SIZE];
+} Chunk;
+
+// One direction of the line: a timed queue of the chunks on the wire,
+// oldest first (they arrive in the order they were sent)
+typedef struct
+{
+    int from;
+    int to;
+    double busyUntil; // ms, when the last byte read has been sent
+    Chunk queue[QUEUE_CHUNKS];
+    int head;         // next chunk to arrive
+    int count;
+    ErrorChannel errors;
+} Direction;
+
+int baudRate = 0;         // bits per second, 0 forwards at pty speed
+double delayMs = 0;       // one-way propagation delay
+ErrorModel errorModel = {0};
+unsigned long long seed = 1;
+int quiet = FALSE;
+
+double nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
 // Returns: serial port file descriptor (fd).
 int openSerialPort(const char *serialPort, struct termios *oldtio, struct termios *newtio)
 {
@@ -46,8 +339,8 @@ int openSerialPort(const char *serialPort, struct termios *oldtio, struct termio
     newtio->c_iflag = IGNPAR;
     newtio->c_oflag = 0;
     newtio->c_lflag = 0;
-    newtio->c_cc[VTIME] = 1; // Inter-character timer unused
-    newtio->c_cc[VMIN] = 0;  // Read without blocking
+    newtio->c_cc[VTIME] = 0; // Inter-character timer unused
+    newtio->c_cc[VMIN] = 0;  // Read without blocking, poll() waits
     tcflush(fd, TCIOFLUSH);
 
     if (tcsetattr(fd, TCSANOW, newtio) == -1)
@@ -62,8 +355,127 @@ void addNoiseToBuffer(unsigned char *buf, size_t errorIndex)
     buf[errorIndex] ^= 0xFF;
 }
 
+// Put on the wire what the line can carry from a port. With a bit rate set,
+// reads are limited to PACING_MS of line time and the direction stays busy
+// while the bytes are being sent; the bytes waiting stay in the port, as in
+// a real UART. Each chunk reaches the other end delayMs after its last byte
+// was sent, with the errors of the model added.
+void transmit(Direction *dir, CableMode cableMode, const char *format)
+{
+    if (dir->count == QUEUE_CHUNKS)
+        return;
+
+    double now = nowMs();
+    // Leave room for the bytes inserted
+    int size = (errorModel.insertRate > 0) ? BUF_SIZE / 2 : BUF_SIZE;
+    if (baudRate > 0)
+    {
+        if (now < dir->busyUntil)
+            return;
+        size = baudRate / BITS_PER_BYTE * PACING_MS / 1000;
+        if (size < 1)
+            size = 1;
+        if (size > BUF_SIZE / 2)
+            size = BUF_SIZE / 2;
+    }
+
+    Chunk *chunk = &dir->queue[(dir->head + dir->count) % QUEUE_CHUNKS];
+    int bytes = read(dir->from, chunk->data, size);
+    if (bytes <= 0)
+        return;
+
+    double sent = now;
+    if (baudRate > 0)
+    {
+        // poll() wakes up to a millisecond after the line became free: bytes
+        // read that soon were waiting and follow the last ones back to back
+        double start = (now - dir->busyUntil < PACING_MS) ? dir->busyUntil : now;
+        dir->busyUntil = start + bytes * BITS_PER_BYTE * 1000.0 / baudRate;
+        sent = dir->busyUntil;
+    }
+    if (cableMode == CableModeOff)
+    {
+        if (!quiet)
+            printf(format, bytes, -1);
+        return;
+    }
+    if (cableMode == CableModeNoise)
+    {
+        addNoiseToBuffer(chunk->data, 0);
+    }
+    if (errorChunkLost(&dir->errors))
+        return;
+
+    chunk->arrival = sent + delayMs;
+    chunk->size = errorApply(&dir->errors, chunk->data, bytes, BUF_SIZE);
+    dir->count++;
+    if (dir->count < QUEUE_CHUNKS && errorDuplicate(&dir->errors))
+    {
+        Chunk *copy = &dir->queue[(dir->head + dir->count) % QUEUE_CHUNKS];
+        *copy = *chunk;
+        dir->count++;
+    }
+}
+
+// Write the chunks that have arrived to the other port
+void deliver(Direction *dir, const char *format)
+{
+    while (dir->count > 0 && dir->queue[dir->head].arrival <= nowMs())
+    {
+        Chunk *chunk = &dir->queue[dir->head];
+        int written = write(dir->to, chunk->data, chunk->size);
+        if (!quiet)
+            printf(format, chunk->size, written);
+        dir->head = (dir->head + 1) % QUEUE_CHUNKS;
+        dir->count--;
+    }
+}
+
+// Milliseconds until something is due on dir, or timeout if sooner
+int nextEvent(const Direction *dir, double now, int timeout)
+{
+    double due[2] = {dir->busyUntil, dir->count > 0 ? dir->queue[dir->head].arrival : 0};
+    for (int i = 0; i < 2; i++)
+    {
+        if (due[i] > now && due[i] - now + 1 < timeout)
+            timeout = (int)(due[i] - now) + 1;
+    }
+    return timeout;
+}
+
+void usage(const char *program)
+{
+    printf("Usage: %s [-b bits/s] [-d delay ms] [-e bit error rate]\n"
+           "       [-g to bad,to good,bad bit error rate] [-x byte drop rate]\n"
+           "       [-i byte insertion rate] [-l chunk loss rate]\n"
+           "       [-u chunk duplication rate] [-s seed] [-q]\n", program);
+    exit(1);
+}
+
 int main(int argc, char *argv[])
 {
+    int option;
+    while ((option = getopt(argc, argv, "b:d:e:g:x:i:l:u:s:q")) != -1)
+    {
+        switch (option)
+        {
+        case 'b': baudRate = atoi(optarg); break;
+        case 'd': delayMs = atof(optarg); break;
+        case 'e': errorModel.bitErrorRate = atof(optarg); break;
+        case 'g':
+            if (sscanf(optarg, "%lf,%lf,%lf", &errorModel.toBad, &errorModel.toGood,
+                       &errorModel.badBitErrorRate) != 3)
+                usage(argv[0]);
+            break;
+        case 'x': errorModel.dropRate = atof(optarg); break;
+        case 'i': errorModel.insertRate = atof(optarg); break;
+        case 'l': errorModel.chunkLossRate = atof(optarg); break;
+        case 'u': errorModel.duplicateRate = atof(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        case 'q': quiet = TRUE; break;
+        default: usage(argv[0]);
+        }
+    }
     printf("\n");
 
     system("socat -dd PTY,link=/dev/ttyS10,mode=777 PTY,link=/dev/emulatorTx,mode=777 &");
@@ -83,6 +495,20 @@ int main(int argc, char *argv[])
            "--- noise        : add fixed noise to the cable\n"
            "--- end          : terminate the program\n"
            "\n");
+    if (baudRate > 0)
+        printf("Line: %d bit/s\n", baudRate);
+    if (delayMs > 0)
+        printf("Propagation delay: %g ms\n", delayMs);
+    if (errorModel.bitErrorRate > 0)
+        printf("Bit error rate: %g\n", errorModel.bitErrorRate);
+    if (errorModel.toBad > 0)
+        printf("Bursts: good -> bad %g, bad -> good %g per bit, bit error rate %g when bad\n",
+               errorModel.toBad, errorModel.toGood, errorModel.badBitErrorRate);
+    if (errorModel.dropRate > 0 || errorModel.insertRate > 0)
+        printf("Bytes dropped: %g, inserted: %g\n", errorModel.dropRate, errorModel.insertRate);
+    if (errorModel.chunkLossRate > 0 || errorModel.duplicateRate > 0)
+        printf("Chunks lost: %g, duplicated: %g\n", errorModel.chunkLossRate, errorModel.duplicateRate);
+    printf("Seed: %llu\n", seed);
 
     // Configure serial ports
     struct termios oldtioTx;
@@ -111,61 +537,54 @@ int main(int argc, char *argv[])
     int oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
     fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
 
-    unsigned char tx2rx[BUF_SIZE] = {0};
-    unsigned char rx2tx[BUF_SIZE] = {0};
+    static Direction tx2rx, rx2tx;
+    tx2rx.from = rx2tx.to = fdTx;
+    tx2rx.to = rx2tx.from = fdRx;
+    // Each direction gets its own errors
+    errorInit(&tx2rx.errors, &errorModel, seed * 2);
+    errorInit(&rx2tx.errors, &errorModel, seed * 2 + 1);
     char rxStdin[BUF_SIZE] = {0};
+    int stdinOpen = TRUE; // stop polling it at end of file (run unattended)
 
     CableMode cableMode = CableModeOn;
     volatile int STOP = FALSE;
 
     printf("Cable ready\n");
+    fflush(stdout);
 
     while (STOP == FALSE)
     {
-        // Read from Tx
-        int bytesFromTx = read(fdTx, tx2rx, BUF_SIZE);
-
-        if (bytesFromTx > 0)
+        // Wait for bytes on a port whose line is free, for the line to
+        // become free again or for a chunk to arrive
+        double now = nowMs();
+        Direction *dirs[] = {&tx2rx, &rx2tx};
+        struct pollfd fds[3];
+        int nfds = 0;
+        int timeout = 100;
+        for (int i = 0; i < 2; i++)
         {
-            if (cableMode == CableModeOff)
-            {
-                printf("bytesFromTx=%d > bytesToRx=CONNECTION OFF\n", bytesFromTx);
-            }
-            else
-            {
-                if (cableMode == CableModeNoise)
-                {
-                    addNoiseToBuffer(tx2rx, 0);
-                }
-
-                int bytesToRx = write(fdRx, tx2rx, bytesFromTx);
-                printf("bytesFromTx=%d > bytesToRx=%d\n", bytesFromTx, bytesToRx);
-            }
+            timeout = nextEvent(dirs[i], now, timeout);
+            if (dirs[i]->busyUntil > now || dirs[i]->count == QUEUE_CHUNKS)
+                continue;
+            fds[nfds].fd = dirs[i]->from;
+            fds[nfds++].events = POLLIN;
         }
-
-        // Read from Rx
-        int bytesFromRx = read(fdRx, rx2tx, BUF_SIZE);
-
-        if (bytesFromRx > 0)
+        if (stdinOpen)
         {
-            if (cableMode == CableModeOff)
-            {
-                printf("bytesToTx=CONNECTION OFF < bytesFromRx=%d\n", bytesFromRx);
-            }
-            else
-            {
-                if (cableMode == CableModeNoise)
-                {
-                    addNoiseToBuffer(rx2tx, 0);
-                }
-
-                int bytesToTx = write(fdTx, rx2tx, bytesFromRx);
-                printf("bytesToTx=%d < bytesFromRx=%d\n", bytesToTx, bytesFromRx);
-            }
+            fds[nfds].fd = STDIN_FILENO;
+            fds[nfds++].events = POLLIN;
         }
+        poll(fds, nfds, timeout);
+
+        transmit(&tx2rx, cableMode, "bytesFromTx=%d > bytesToRx=%d\n");
+        transmit(&rx2tx, cableMode, "bytesToTx=%d < bytesFromRx=%d\n");
+        deliver(&tx2rx, "bytesFromTx=%d > bytesToRx=%d\n");
+        deliver(&rx2tx, "bytesToTx=%d < bytesFromRx=%d\n");
 
         // Read commands from STDIN to control the cable mode
-        int fromStdin = read(STDIN_FILENO, rxStdin, BUF_SIZE);
+        int fromStdin = stdinOpen ? read(STDIN_FILENO, rxStdin, BUF_SIZE) : -1;
+        if (fromStdin == 0)
+            stdinOpen = FALSE;
         if (fromStdin > 0)
         {
             rxStdin[fromStdin - 1] = '\0';
@@ -193,6 +612,9 @@ int main(int argc, char *argv[])
         }
     }
 
+    errorPrint(&tx2rx.errors, "Tx > Rx");
+    errorPrint(&rx2tx.errors, "Tx < Rx");
+
     // Restore the old port settings
     if (tcsetattr(fdRx, TCSANOW, &oldtioRx) == -1)
     {
@@ -0,0 +1,25 @@
+// Byte stuffing header.
+// Encoder for the data field of I-frames: escapes FLAG (0x7E) and ESC (0x7D)
+// and computes BCC2 in the same pass.
+
+#ifndef _BYTE_STUFFING_H_
+#define _BYTE_STUFFING_H_
+
+// Largest output of stuffData() for size bytes of data (every byte and
+// BCC2 escaped).
+#define STUFFED_BOUND(size) (2 * ((size) + 1))
+
+// Write the stuffed data followed by the stuffed BCC2 (XOR of all data
+// bytes) to dst, which must hold STUFFED_BOUND(size) bytes.
+// Uses AVX2 or SSE2 to find the bytes to escape when the CPU has them.
+// Return the number of bytes written.
+int stuffData(unsigned char *dst, const unsigned char *data, int size);
+
+// Portable byte-by-byte version, same output as stuffData().
+int stuffDataScalar(unsigned char *dst, const unsigned char *data, int size);
+
+// Same as stuffData() without appending anything: the XOR of the data is
+// returned in *bcc so the caller can append its own check value.
+int stuffBytes(unsigned char *dst, const unsigned char *data, int size, unsigned char *bcc);
+
+#endif // _BYTE_STUFFING_H_
@@ -0,0 +1,32 @@
+// Compression header.
+// Fast LZ77 codec in the style of LZ4 for the data of DATA packets. Each
+// block is compressed on its own, so a lost or repeated packet never
+// affects the others.
+//
+// A block is a list of sequences: a token (literal count in the high
+// nibble, match length - 4 in the low nibble, 15 meaning more length bytes
+// follow, each adding up to 255), the literals, then a 2-byte offset
+// (little-endian) back into the output and the match length bytes. The
+// last sequence only has literals.
+
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+// Codecs advertised in the START packet
+#define CODEC_NONE 0x00
+#define CODEC_LZ 0x01
+
+// First byte of the data of each DATA packet when a codec is in use
+#define BLOCK_STORED 0x00 // plain copy, the block did not compress
+#define BLOCK_LZ 0x01
+
+// Compress size bytes of src into dst, which holds capacity bytes.
+// Return the compressed size, or "-1" if it does not fit in capacity (the
+// block should then be stored as it is).
+int lzCompress(const unsigned char *src, int size, unsigned char *dst, int capacity);
+
+// Decompress a block of size bytes into dst, which holds capacity bytes.
+// Return the decompressed size, or "-1" if the block is corrupt.
+int lzDecompress(const unsigned char *src, int size, unsigned char *dst, int capacity);
+
+#endif // _COMPRESSION_H_
@@ -0,0 +1,70 @@
+// Disk writer header.
+// Output files of the receiver, each preallocated to the size announced in
+// its START packet. Data is written at its offset with WRITEVs queued on an
+// io_uring set up once per receiver, submitted together and reaped before
+// the caller reuses the buffers, or with pwritev() when the kernel has no
+// io_uring.
+
+#ifndef _DISK_WRITER_H_
+#define _DISK_WRITER_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define WRITER_QUEUE 16   // WRITEVs in flight at once
+#define WRITER_MAX_IOV 64 // buffers per WRITEV
+
+// One WRITEV, kept until its completion since the kernel reads iov then
+typedef struct
+{
+    struct iovec iov[WRITER_MAX_IOV];
+    int count;
+    off_t offset;
+    size_t size;
+} WriterRequest;
+
+typedef struct
+{
+    int fd;     // file open, -1 if none
+    int ringFd; // -1 when writing with pwritev()
+    unsigned char *sqRing;
+    unsigned char *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    // fields of the rings, in the mappings above
+    unsigned int *sqTail, *sqMask, *sqArray;
+    unsigned int *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    WriterRequest requests[WRITER_QUEUE];
+    int queued; // requests not yet submitted
+} DiskWriter;
+
+// Set up the io_uring used by every file of the receiver.
+void writerInit(DiskWriter *writer);
+
+// Create filename, truncated unless keep is TRUE (a transfer being resumed),
+// and reserve size bytes for it.
+// Return "0" on success or "-1" on error.
+int writerOpen(DiskWriter *writer, const char *filename, off_t size, int keep);
+
+// Queue count buffers one after the other, starting at offset. They must
+// stay valid until writerFlush() (a full queue is flushed here).
+// Return "0" on success or "-1" on error.
+int writerWrite(DiskWriter *writer, const struct iovec *iov, int count, off_t offset);
+
+// Submit the queued writes and wait until all of them completed.
+// Return "0" on success or "-1" on error.
+int writerFlush(DiskWriter *writer);
+
+// Flush the data written so far to the disk.
+int writerSync(DiskWriter *writer);
+
+// Cut the file at size (the bytes actually received) and close it.
+void writerClose(DiskWriter *writer, off_t size);
+
+// Release the io_uring.
+void writerFree(DiskWriter *writer);
+
+#endif // _DISK_WRITER_H_
@@ -0,0 +1,26 @@
+// Erasure code header.
+// Repair packets for a group of n packets: with k repairs, any k packets of
+// the group that are lost are rebuilt from the others. A single repair is
+// the XOR of the group; more are the rows of a Cauchy matrix over GF(256),
+// so any n of the n + k packets rebuild the group. Packets shorter than the
+// longest of the group count as padded with zeros.
+
+#ifndef _ERASURE_CODE_H_
+#define _ERASURE_CODE_H_
+
+#define ERASURE_MAX_GROUP 64
+#define ERASURE_MAX_REPAIR 16
+
+// Add packet i of a group (size bytes) to repair j of k, which starts as
+// zeros and is as long as the longest packet.
+void erasureAdd(int k, int j, int i, unsigned char *repair, const unsigned char *packet, int size);
+
+// Rebuild the packets of a group of n with present[i] FALSE from the others
+// and count repairs, repairs[r] being repair index[r] of k. Every buffer
+// holds size bytes, the present packets padded with zeros. The repairs are
+// used as scratch.
+// Return "0" on success or "-1" if fewer repairs than packets lost.
+int erasureRebuild(int k, int n, unsigned char *packets[], const int present[],
+                   unsigned char *const repairs[], const int index[], int count, int size);
+
+#endif // _ERASURE_CODE_H_
@@ -0,0 +1,37 @@
+// Event loop header.
+// Waits on the serial port and a millisecond retransmission timer with
+// epoll and timerfd, instead of SIGALRM and polling read() every VTIME.
+
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#define EVENT_READABLE 0x01
+#define EVENT_TIMER 0x02
+
+typedef struct
+{
+    int epfd;
+    int fd;      // serial port, non-blocking
+    int timerfd;
+} EventLoop;
+
+// Watch the serial port fd (which must be O_NONBLOCK).
+// Return "0" on success or "-1" on error.
+int loopInit(EventLoop *loop, int fd);
+
+void loopClose(EventLoop *loop);
+
+// Arm the timer to expire once in ms milliseconds, or disarm it if ms is 0.
+void loopSetTimer(EventLoop *loop, int ms);
+
+// Wait up to waitMs milliseconds (-1 forever, 0 to only check) for the port
+// to have data or the timer to expire.
+// Return a mask of EVENT_READABLE / EVENT_TIMER, 0 if nothing happened.
+int loopWait(EventLoop *loop, int waitMs);
+
+// Write all size bytes. When the port's output buffer is full, waits for
+// it to drain (POLLOUT) instead of spinning on write().
+// Return number of bytes written, or "-1" on error.
+int loopWrite(EventLoop *loop, const unsigned char *buf, int size);
+
+#endif // _EVENT_LOOP_H_
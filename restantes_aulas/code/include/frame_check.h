@@ -0,0 +1,46 @@
+// Frame check sequence header.
+// Check value carried after the data field of I-frames: the original
+// one-byte XOR (BCC2), the HDLC CRC-16-CCITT (X.25) or CRC-32C. The CRCs
+// use slicing-by-8 tables, and CRC-32C the SSE4.2 crc32 instruction when
+// the CPU has it.
+
+#ifndef _FRAME_CHECK_H_
+#define _FRAME_CHECK_H_
+
+typedef enum
+{
+    FcsBcc,
+    FcsCrc16,
+    FcsCrc32c,
+} FcsType;
+
+#define MAX_FCS_SIZE 4
+
+// Size in bytes of the check value.
+int fcsSize(FcsType type);
+
+// Check value of size bytes of data.
+unsigned int fcsCompute(FcsType type, const unsigned char *data, int size);
+
+// Check value of the bytes that gave fcs followed by size bytes of data,
+// so a data field split in parts is checked part by part. fcsCompute() is
+// fcsUpdate() from 0.
+unsigned int fcsUpdate(FcsType type, unsigned int fcs, const unsigned char *data, int size);
+
+// Write a check value to out, least significant byte first.
+// Return the number of bytes written.
+int fcsStore(FcsType type, unsigned int fcs, unsigned char *out);
+
+// Write the check value of data to out, least significant byte first.
+// Return the number of bytes written.
+int fcsAppend(FcsType type, const unsigned char *data, int size, unsigned char *out);
+
+// Return TRUE if the last fcsSize() bytes of frame are the check value of
+// the bytes before them.
+int fcsCheck(FcsType type, const unsigned char *frame, int size);
+
+// Table-only versions, for comparison with the hardware path.
+unsigned int crc16Table(const unsigned char *data, int size);
+unsigned int crc32cTable(const unsigned char *data, int size);
+
+#endif // _FRAME_CHECK_H_
@@ -0,0 +1,96 @@
+// Frame decoder header.
+// Incremental decoder for link layer frames. Bytes are read from the serial
+// port in bulk into a ring buffer and a table-driven state machine resumes
+// across reads, so frames may be split over several reads and a single read
+// may hold several frames. Every frame with a valid header is classified
+// and returned, whatever the caller is waiting for.
+
+#ifndef _FRAME_DECODER_H_
+#define _FRAME_DECODER_H_
+
+#include "link_layer.h"
+#include "link_options.h"
+#include "frame_check.h"
+#include "reed_solomon.h"
+
+#define DECODER_RING_SIZE 4096 // power of two
+// data field with its check value, and the parity of forward error correction
+#define DECODER_MAX_DATA RS_ENCODED_BOUND(MAX_LINK_PAYLOAD + MAX_FCS_SIZE)
+
+// Control field: frame type in the low bits, sequence number in the upper
+// bits (bit 7 in stop-and-wait, upper nibble in the windowed modes)
+#define CTRL_I 0x00
+#define CTRL_REJ 0x01
+#define CTRL_SET 0x03
+#define CTRL_RR 0x05
+#define CTRL_UA 0x07
+#define CTRL_SACK 0x09
+#define CTRL_DISC 0x0B
+
+typedef enum {START, FLAG_RCV, A_RCV, C_RCV, BCC_NORMAL, BCC_DATA, ESC_RCV, N_STATES} stateMachine;
+
+typedef enum
+{
+    FrameUnknown,
+    FrameSet,
+    FrameUa,
+    FrameDisc,
+    FrameRr,
+    FrameRej,
+    FrameSack,
+    FrameInfo,
+} FrameType;
+
+typedef struct
+{
+    FrameType type;
+    int seq;                   // N(S) of I-frames, N(R) of RR/REJ/SACK
+    unsigned char control;
+    const unsigned char *data; // destuffed data field, valid until the next decoderNext()
+    int size;                  // size of the data without check value, -1 if the check failed
+    int hasData;               // FALSE for supervision and unnumbered frames
+    int corrected;             // bytes of the data field corrected by FEC
+} Frame;
+
+typedef struct
+{
+    unsigned char ring[DECODER_RING_SIZE];
+    unsigned int head; // next position written by decoderFill()
+    unsigned int tail; // next position consumed by decoderNext()
+    stateMachine state;
+    unsigned char control;
+    unsigned char data[DECODER_MAX_DATA];
+    int size;
+    unsigned char BCC2; // XOR of the data received so far, BCC2 included
+    int seqShift;
+    FcsType fcs;
+    int fecParity;
+    unsigned char types[256]; // FrameType of each control field
+} FrameDecoder;
+
+// Discard buffered bytes and any partial frame. Control fields are
+// classified as in stop-and-wait, and data checked with BCC2 without FEC,
+// until decoderSetSequenceShift(), decoderSetFcs() and decoderSetFec().
+void decoderInit(FrameDecoder *decoder);
+
+// Position of the sequence number in the control field.
+void decoderSetSequenceShift(FrameDecoder *decoder, int shift);
+
+// Check value expected after the data field.
+void decoderSetFcs(FrameDecoder *decoder, FcsType fcs);
+
+// Reed-Solomon parity per block of the data field of I-frames, 0 for none.
+// Errors are corrected before the check value is verified.
+void decoderSetFec(FrameDecoder *decoder, int parity);
+
+// Read as many bytes as the serial port has available (and fit) into the
+// ring buffer, without waiting: the port is non-blocking (VMIN = VTIME = 0)
+// and the caller's event loop waits until it is readable.
+// Return number of bytes read (0 if there were none), or "-1" on error.
+int decoderFill(FrameDecoder *decoder, int fd);
+
+// Decode buffered bytes until the end of the next frame with a valid header.
+// Return TRUE and fill frame if one was completed, FALSE if more bytes are needed.
+int decoderNext(FrameDecoder *decoder, Frame *frame);
+
+#endif // _FRAME_DECODER_H_
@@ -0,0 +1,68 @@
+// Link async header.
+// Submission/completion interface of a connection (see link_connection.h):
+// buffers are queued without waiting, and llprogress_r() runs the protocol
+// (sends what the window has room for, takes acknowledgements, timeouts
+// and I-frames) and reports each request once it completes, through a
+// callback or a completion queue. A caller waits on the descriptor of
+// llpollfd_r() with the other things it serves, so the link stays busy
+// while the caller does other work. The blocking calls and these must not
+// be mixed on the same connection.
+
+#ifndef _LINK_ASYNC_H_
+#define _LINK_ASYNC_H_
+
+#include "link_connection.h"
+
+// Requests a connection holds at once, from submission until their
+// completion is taken.
+#define ASYNC_QUEUE 64
+
+typedef enum
+{
+    LinkWrite,
+    LinkRead,
+} LinkOperation;
+
+typedef struct
+{
+    LinkOperation operation;
+    void *tag;          // given at submission
+    unsigned char *buf; // given at submission
+    // bytes written (acknowledged, or sent with LL_ARQ=none) or read, -1 if
+    // the frame was retransmitted nRetransmissions times or the peer
+    // disconnected
+    int result;
+} LinkCompletion;
+
+// Called from llprogress_r() with each completion, which is then not queued.
+// It may submit new requests.
+typedef void (*LinkCallback)(LinkConnection *link, const LinkCompletion *completion, void *arg);
+
+void llsetcallback_r(LinkConnection *link, LinkCallback callback, void *arg);
+
+// Queue bufSize bytes of buf to be sent as one I-frame. buf must stay valid
+// until its completion, since retransmissions read it again.
+// Return "0" on success, or "-1" if the queue is full, bufSize too large or
+// the link gave up.
+int llsubmitwrite_r(LinkConnection *link, const unsigned char *buf, int bufSize, void *tag);
+
+// Queue buf (maxPayload bytes) for the next packet received. Frames are
+// only taken from the port while a read is queued.
+// Return "0" on success, or "-1" if the queue is full or the link gave up.
+int llsubmitread_r(LinkConnection *link, unsigned char *buf, void *tag);
+
+// Do all the work that is possible without waiting, and if that completed
+// nothing wait up to waitMs milliseconds (-1 forever) for the port or the
+// retransmission timer and try again. Requests fail (result -1) once the
+// link gives up.
+// Return the number of requests completed.
+int llprogress_r(LinkConnection *link, int waitMs);
+
+// Take up to max completions from the queue.
+// Return the number taken.
+int llcompletions_r(LinkConnection *link, LinkCompletion *completions, int max);
+
+// Descriptor that polls readable when llprogress_r() has work to do.
+int llpollfd_r(LinkConnection *link);
+
+#endif // _LINK_ASYNC_H_
@@ -0,0 +1,41 @@
+// Link connection header.
+// Reentrant link layer: llopen_r() returns a handle that holds all the state
+// of one connection (port, timer, windows, statistics), and the other calls
+// take it, so one process can drive several serial ports, each on its own
+// thread. Timeouts come from a timerfd per connection, no signals are used.
+// The functions in link_layer.h and link_options.h work on a default
+// connection opened by llopen().
+
+#ifndef _LINK_CONNECTION_H_
+#define _LINK_CONNECTION_H_
+
+#include "link_layer.h"
+#include "link_options.h"
+#include "link_statistics.h"
+
+typedef struct LinkConnection LinkConnection;
+
+// Open the port in parameters and run the SET/UA handshake, proposing
+// options (transmitter) or accepting up to them (receiver).
+// Return the connection, or NULL on error.
+LinkConnection *llopen_r(LinkLayer parameters, LinkOptions options);
+
+// llwrite(), llwritepacket(), llwritev() and lldrain() on link.
+int llwrite_r(LinkConnection *link, const unsigned char *buf, int bufSize);
+int llwritepacket_r(LinkConnection *link, const unsigned char *header, int headerSize,
+                    const unsigned char *data, int dataSize);
+int llwritev_r(LinkConnection *link, const struct iovec *iov, int iovcnt);
+int lldrain_r(LinkConnection *link);
+
+// llread() on link.
+int llread_r(LinkConnection *link, unsigned char *packet);
+
+// Run the DISC exchange, restore the port and free link.
+// Return "1" on success or "-1" on error.
+int llclose_r(LinkConnection *link, int showStatistics);
+
+// Options agreed on link, and its counters so far.
+LinkOptions llgetoptions_r(LinkConnection *link);
+LinkStatistics llgetstatistics_r(LinkConnection *link);
+
+#endif // _LINK_CONNECTION_H_
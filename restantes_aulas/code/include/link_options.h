@@ -0,0 +1,78 @@
+// Link layer options header.
+// Extensions to the link layer that are negotiated between transmitter and
+// receiver during llopen(). The interface in link_layer.h is left untouched.
+
+#ifndef _LINK_OPTIONS_H_
+#define _LINK_OPTIONS_H_
+
+#include "frame_check.h"
+#include <sys/uio.h>
+
+typedef enum
+{
+    ArqStopAndWait,
+    ArqGoBackN,
+    ArqSelectiveRepeat,
+    // I-frames are sent once and never acknowledged: the receiver delivers
+    // those that pass the check and drops the others, for lines whose
+    // return path is lossy or missing (see LL_REPAIR in application_layer.c)
+    ArqNone,
+} ArqMode;
+
+typedef struct
+{
+    ArqMode arq;
+    // Frames in flight (windowed modes only), 0 for the mode's default
+    // (7 for go-back-N, MAX_SR_WINDOW for selective repeat). The receiver
+    // accepts no larger window when it is set.
+    int window;
+    FcsType fcs; // Check value after the data field of I-frames
+    int maxPayload; // Largest I-frame data field, 0 for the default
+    // Transfer being resumed: the transmitter proposes its ID (0 for none),
+    // the receiver answers with the offset it holds for it (0 if another)
+    unsigned long long transferId;
+    unsigned long long resumeOffset;
+    // Reed-Solomon parity bytes per block of the I-frame data field (see
+    // reed_solomon.h), 0 for none. The transmitter's choice is agreed.
+    int fecParity;
+} LinkOptions;
+
+// Windowed modes carry the sequence number in the upper nibble of the
+// control field, so up to MAX_WINDOW frames can be in flight at once.
+#define SEQ_MODULUS 16
+#define MAX_WINDOW (SEQ_MODULUS - 1)
+#define MAX_SR_WINDOW (SEQ_MODULUS / 2)
+
+// Largest data field both sides may agree on. The transmitter proposes
+// MAX_PAYLOAD_SIZE by default and the receiver accepts up to this.
+#define MAX_LINK_PAYLOAD (64 * 1024)
+
+// Options proposed by the transmitter (or accepted by the receiver) on the
+// next llopen(). Without a call the link runs in stop-and-wait.
+void llsetoptions(LinkOptions options);
+
+// Options agreed with the peer on the last llopen().
+LinkOptions llgetoptions();
+
+// Largest header accepted by llwritepacket().
+#define MAX_PACKET_HEADER 32
+
+// Same as llwrite() for a packet made of a header and its data, stuffed
+// straight from where they are. The header is copied but data is not: it
+// must stay valid until lldrain(), since retransmissions read it again.
+// Return "0" on success or "-1" on error.
+int llwritepacket(const unsigned char *header, int headerSize,
+                  const unsigned char *data, int dataSize);
+
+// Same as llwrite() for a packet gathered from iovcnt segments, which are
+// checked and stuffed where they are: no packet needs to be assembled first.
+// They may be reused once it returns (windowed modes keep a copy until
+// acknowledged).
+// Return "0" on success or "-1" on error.
+int llwritev(const struct iovec *iov, int iovcnt);
+
+// Wait until every I-frame sent was acknowledged.
+// Return "0" on success or "-1" on error.
+int lldrain();
+
+#endif // _LINK_OPTIONS_H_
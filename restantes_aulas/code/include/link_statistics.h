@@ -0,0 +1,49 @@
+// Link statistics header.
+// Counters kept by the link layer from llopen() to llclose(), printed by
+// llclose() when asked to show statistics.
+
+#ifndef _LINK_STATISTICS_H_
+#define _LINK_STATISTICS_H_
+
+typedef struct
+{
+    // every frame written to or decoded from the port, and their bytes on
+    // the wire (received bytes include noise and partial frames)
+    unsigned long long framesSent;
+    unsigned long long bytesSent;
+    unsigned long long framesReceived;
+    unsigned long long bytesReceived;
+
+    // I-frames: transmissions and their bytes on the wire, frames delivered
+    unsigned long long infoFramesSent;
+    unsigned long long infoBytesSent;
+    unsigned long long infoFramesReceived;
+    // data fields given to llwrite() and returned by llread()
+    unsigned long long dataBytesSent;
+    unsigned long long dataBytesReceived;
+    // bytes added by byte stuffing to the frames sent
+    unsigned long long stuffingBytes;
+
+    unsigned long long retransmissions; // I-frames sent again
+    unsigned long long timeouts;        // retransmission timer expirations
+    unsigned long long rejSent;         // REJ, or SACK reporting a bad frame
+    unsigned long long rejReceived;
+    unsigned long long duplicates;      // I-frames received again
+    unsigned long long badFrames;       // frames whose check value failed
+    unsigned long long fecFrames;       // I-frames saved by FEC correction
+    unsigned long long fecBytes;        // bytes FEC corrected in them
+
+    double seconds;  // since llopen()
+    double goodput;  // data bits delivered per second
+    // goodput over the baud rate, and what stop-and-wait could reach with
+    // the average I-frame and the measured round-trip time: 1 / (1 + 2a),
+    // a being the propagation delay over the time to send an I-frame
+    double efficiency;
+    double stopAndWaitEfficiency;
+    int baudRate;
+} LinkStatistics;
+
+// Counters of the current (or last closed) connection.
+LinkStatistics llgetstatistics();
+
+#endif // _LINK_STATISTICS_H_
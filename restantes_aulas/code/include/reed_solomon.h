@@ -0,0 +1,40 @@
+// Reed-Solomon header.
+// Forward error correction for the data field of I-frames: Reed-Solomon
+// codes over GF(256) (polynomial 0x11D), the field split in blocks of up to
+// RS_BLOCK bytes, each ending in parity bytes. A block with p parity bytes
+// is corrected as long as at most p / 2 of its bytes are wrong. Field
+// multiplication uses log/antilog tables, and the encoder and syndromes
+// a 256-entry product table per constant.
+
+#ifndef _REED_SOLOMON_H_
+#define _REED_SOLOMON_H_
+
+#define RS_BLOCK 255
+#define RS_MAX_PARITY 32
+
+// Largest output of rsEncode() for size bytes, whatever the parity.
+#define RS_ENCODED_BOUND(size) \
+    ((size) + ((size) + RS_BLOCK - RS_MAX_PARITY - 1) / (RS_BLOCK - RS_MAX_PARITY) * RS_MAX_PARITY)
+
+// Size of size bytes encoded with parity bytes per block.
+int rsEncodedSize(int parity, int size);
+
+// Write size bytes of data to out in blocks of RS_BLOCK - parity bytes (the
+// last one shorter), each followed by its parity bytes.
+// Return the number of bytes written.
+int rsEncode(int parity, const unsigned char *data, int size, unsigned char *out);
+
+// Correct the blocks written by rsEncode() in place and remove their parity,
+// leaving the data at the start of buf. *corrected gets the number of bytes
+// corrected.
+// Return the size of the data, or "-1" if a block could not be corrected.
+int rsDecode(int parity, unsigned char *buf, int size, int *corrected);
+
+// GF(256) arithmetic of the codes, also used by the erasure code.
+unsigned char gfMultiply(unsigned char a, unsigned char b);
+unsigned char gfInverse(unsigned char a);
+
+// dst[i] ^= c * src[i] for size bytes, a plain XOR when c is 1.
+void gfMulAdd(unsigned char *dst, const unsigned char *src, unsigned char c, int size);
+
+#endif // _REED_SOLOMON_H_
@@ -0,0 +1,39 @@
+// Retransmission timeout header.
+// Estimates the round-trip time of I-frames from their acknowledgements
+// (Jacobson/Karels, as in RFC 6298) and derives the retransmission timeout.
+
+#ifndef _RTO_ESTIMATOR_H_
+#define _RTO_ESTIMATOR_H_
+
+#define RTO_MIN_MS 50
+#define RTO_MAX_MS 60000
+
+typedef struct
+{
+    double srtt;   // smoothed round-trip time (ms), 0 before the first sample
+    double rttvar; // round-trip time variation (ms)
+    int rto;       // timeout without backoff (ms)
+    int backoff;   // consecutive timeouts, each one doubles the timeout
+    int samples;
+} RtoEstimator;
+
+// Start with initialMs as the timeout until the first sample is taken.
+void rtoInit(RtoEstimator *estimator, int initialMs);
+
+// Update the estimate with the round-trip time of a frame that was only
+// sent once (Karn's rule). Also clears the backoff.
+void rtoSample(RtoEstimator *estimator, double rttMs);
+
+// A timeout expired: double the timeout until the next sample or rtoReset().
+void rtoBackoff(RtoEstimator *estimator);
+
+// The peer answered a frame (even a retransmitted one), clear the backoff.
+void rtoReset(RtoEstimator *estimator);
+
+// Timeout to arm for the next transmission (ms), backoff included.
+int rtoCurrent(const RtoEstimator *estimator);
+
+// Milliseconds on the monotonic clock.
+double rtoNow();
+
+#endif // _RTO_ESTIMATOR_H_
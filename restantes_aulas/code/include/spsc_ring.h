@@ -0,0 +1,36 @@
+// Single-producer/single-consumer ring header.
+// Lock-free ring of slot indexes shared by two threads: the caller keeps
+// the slots in its own array, and the ring only says which slot to fill or
+// to consume next. A side that must wait spins briefly, then sleeps.
+
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stdatomic.h>
+
+typedef struct
+{
+    unsigned int capacity;     // number of slots, power of two
+    _Atomic unsigned int head; // slots published by the producer
+    _Atomic unsigned int tail; // slots released by the consumer
+} SpscRing;
+
+void ringInit(SpscRing *ring, unsigned int capacity);
+
+// Producer: index of the next slot to fill, waiting while the ring is full.
+unsigned int ringAcquire(SpscRing *ring);
+
+// Producer: hand the slot from ringAcquire() to the consumer.
+void ringPublish(SpscRing *ring);
+
+// Consumer: index of the next slot published, waiting while the ring is empty.
+unsigned int ringPeek(SpscRing *ring);
+
+// Consumer: give the slot from ringPeek() back to the producer.
+void ringRelease(SpscRing *ring);
+
+// Consumer: number of slots published and not released yet, so that
+// several can be taken at once (slot ringPeek() + i for i below it).
+unsigned int ringReady(SpscRing *ring);
+
+#endif // _SPSC_RING_H_
@@ -1,13 +1,73 @@
 // Application layer protocol implementation
 
+#define _GNU_SOURCE // nftw()
 #include "application_layer.h"
+#include "compression.h"
+#include "disk_writer.h"
+#include "erasure_code.h"
+#include "link_options.h"
+#include "spsc_ring.h"
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define DATA 0x01
 #define START 0x02
 #define END 0x03
+#define REPAIR 0x04
+
+// Codec of the DATA packets sent, chosen with LL_COMPRESS=lz (transmitter)
+int codec = CODEC_NONE;
+// Erasure coding, chosen with LL_REPAIR=n,k (transmitter): k REPAIR packets
+// follow every group of n DATA packets
+int groupSize = 0;
+int groupRepairs = 0;
+// START and END are sent this many times when nothing is acknowledged
+#define CONTROL_COPIES 3
+// Byte of the file the transfer starts at, agreed in llopen() when an
+// interrupted transfer is resumed
+off_t resumeOffset = 0;
+
+int isDirectory(const char *path);
+int sendBatch(const char *directory);
+unsigned long long transferId(const char *filename);
+int readJournal(const char *filename, unsigned long long *id, unsigned long long *offset);
+
+// Link extensions are chosen through the environment, so that main.c keeps
+// its interface:
+//   LL_ARQ=sw|gbn|sr|none ARQ mode proposed by the transmitter (default sw),
+//                    none sending I-frames once without acknowledgements
+//   LL_WINDOW=n      frames in flight (tx) / largest window accepted (rx)
+//   LL_FCS=bcc|crc16|crc32c  check value of I-frames (default bcc)
+//   LL_MAX_PAYLOAD=n largest frame data field proposed (tx) / accepted (rx)
+//   LL_FEC=n         Reed-Solomon parity bytes per 255-byte block of I-frames,
+//                    correcting n / 2 byte errors in each (tx, default 0)
+LinkOptions readLinkOptions()
+{
+    LinkOptions linkOptions = {ArqStopAndWait, 0, FcsBcc, 0, 0, 0, 0};
+    const char *arq = getenv("LL_ARQ");
+    const char *window = getenv("LL_WINDOW");
+    const char *fcs = getenv("LL_FCS");
+    const char *maxPayload = getenv("LL_MAX_PAYLOAD");
+    const char *fec = getenv("LL_FEC");
+
+    if(arq != NULL && strcmp(arq, "gbn") == 0) linkOptions.arq = ArqGoBackN;
+    else if(arq != NULL && strcmp(arq, "sr") == 0) linkOptions.arq = ArqSelectiveRepeat;
+    else if(arq != NULL && strcmp(arq, "none") == 0) linkOptions.arq = ArqNone;
+    if(window != NULL) linkOptions.window = atoi(window);
+    if(fcs != NULL && strcmp(fcs, "crc16") == 0) linkOptions.fcs = FcsCrc16;
+    else if(fcs != NULL && strcmp(fcs, "crc32c") == 0) linkOptions.fcs = FcsCrc32c;
+    if(maxPayload != NULL) linkOptions.maxPayload = atoi(maxPayload);
+    if(fec != NULL) linkOptions.fecParity = atoi(fec);
+    return linkOptions;
+}
 
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename)
@@ -23,8 +83,27 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
     linkLayer.role = linkLayerRole;
     strcpy( linkLayer.serialPort, serialPort);
     linkLayer.timeout = timeout;
+    LinkOptions linkOptions = readLinkOptions();
+    if(linkLayerRole == LlRx)
+        readJournal(filename, &linkOptions.transferId, &linkOptions.resumeOffset);
+    else if(!isDirectory(filename))
+        linkOptions.transferId = transferId(filename);
+    llsetoptions(linkOptions);
+    const char *compress = getenv("LL_COMPRESS");
+    if(compress != NULL && strcmp(compress, "lz") == 0) codec = CODEC_LZ;
+    const char *repair = getenv("LL_REPAIR");
+    if(repair != NULL && sscanf(repair, "%d,%d", &groupSize, &groupRepairs) == 2){
+        if(groupSize < 1 || groupSize > ERASURE_MAX_GROUP || groupRepairs < 0 ||
+           groupRepairs > ERASURE_MAX_REPAIR || groupSize + groupRepairs > ERASURE_MAX_GROUP){
+            printf("LL_REPAIR=n,k needs 1 <= n, 0 <= k <= %d and n + k <= %d\n",
+                   ERASURE_MAX_REPAIR, ERASURE_MAX_GROUP);
+            return;
+        }
+    }
     int fd = llopen(linkLayer);    
     if(fd==-1) return;
+    resumeOffset = llgetoptions().resumeOffset;
+    if(resumeOffset > 0) printf("Resuming from byte %lld\n", (long long)resumeOffset);
     appLayer.fileDescriptor = fd;
     switch(appLayer.status){
         case 0:
@@ -32,6 +111,11 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
             receivePacket(fd, filename);
             break;
         case 1:
+            if(isDirectory(filename)){
+                printf("Sending directory \n");
+                sendBatch(filename);
+                break;
+            }
             printf("Sending file \n");
             sendPacket(fd, 0x02, filename);
             sendPacket(fd, 0x01, filename);
@@ -44,7 +128,7 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
     }
 
     printf("END\n");
-    llclose(0, linkLayer);
+    llclose(TRUE, linkLayer);
 }
 int sendPacket(int fd ,unsigned char C, const char *filename)
 {
@@ -58,75 +142,981 @@ int sendPacket(int fd ,unsigned char C, const char *filename)
             return -1;
     }
 }
-int sendControlPacket(int fd, unsigned char C,const char* filename){
+// Numbers in packets (file size, offsets) take as many bytes as their value
+// needs, up to 8: a length byte, then the value big-endian.
+// Return the new size of buf.
+int putNumber(unsigned char *buf, int n, unsigned long long value)
+{
+    int length = 1;
+    while(length < 8 && (value >> (8 * length)) != 0) length++;
+    buf[n++] = length;
+    for(int i = length - 1; i >= 0; i--) buf[n++] = value >> (8 * i);
+    return n;
+}
+
+unsigned long long getNumber(const unsigned char *value, int length)
+{
+    unsigned long long number = 0;
+    for(int i = 0; i < length && i < 8; i++) number = number << 8 | value[i];
+    return number;
+}
+
+/**
+ * @brief Sends the START/END packet of the file at path, named name for the
+ * receiver. Files of a batch carry the TLV T=0x03 so the receiver waits for
+ * the next one after END.
+ */
+int sendFileControlPacket(unsigned char C, const char *path, const char *name, int batch){
         
-        FILE* fd_file = fopen(filename,"rb");
-        fseek(fd_file, 0L, SEEK_END);
-        int file_size = ftell(fd_file);
-        fclose(fd_file);
+        struct stat st;
+        if(stat(path, &st) < 0) return -1;
         
-        unsigned char buffer[1000];
+        // the TLVs before the name, the name and the TLVs after it are
+        // gathered by the link layer, the name is not copied
+        unsigned char buffer[16], options[32];
         buffer[0] = C;
         buffer[1] = 0x00;
-        buffer[2] = 0x02;
-        buffer[3] = file_size>>8;
-        buffer[4] = (unsigned char) file_size;
-        buffer[5] = 0x01;
-        buffer[6] = strlen(filename);
-        strcpy(buffer+7,filename);
+        int size = putNumber(buffer, 2, st.st_size);
+        buffer[size++] = 0x01;
+        buffer[size++] = strlen(name);
+        int n = 0;
+        if(codec != CODEC_NONE){
+            options[n++] = 0x02;
+            options[n++] = 1;
+            options[n++] = codec;
+        }
+        if(batch){
+            options[n++] = 0x03;
+            options[n++] = 1;
+            options[n++] = 1;
+        }
+        if(C == START && resumeOffset > 0){
+            // DATA starts at this byte of the file
+            options[n++] = 0x05;
+            n = putNumber(options, n, resumeOffset);
+        }
+        if(C == START && groupRepairs > 0){
+            options[n++] = 0x06;
+            options[n++] = 2;
+            options[n++] = groupSize;
+            options[n++] = groupRepairs;
+        }
+        struct iovec packet[3] = {
+            {buffer, size},
+            {(void *)name, strlen(name)},
+            {options, n},
+        };
+
+        // without acknowledgements, copies make a lost START or END unlikely
+        int copies = (llgetoptions().arq == ArqNone) ? CONTROL_COPIES : 1;
+        for(int i = 0; i < copies; i++) llwritev(packet, 3);
+        return 0;
+}
+
+int sendControlPacket(int fd, unsigned char C,const char* filename){
+        (void)fd; // the link layer has the port
+        return sendFileControlPacket(C, filename, filename, FALSE);
+}
+
+int isDirectory(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Identifies a file across runs: FNV-1a of its name, size and modification
+// time, so a changed file is never resumed
+unsigned long long transferId(const char *filename)
+{
+    struct stat st;
+    if(stat(filename, &st) < 0) return 0;
+    unsigned long long values[] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for(const char *c = filename; *c != '\0'; c++) hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+    const unsigned char *bytes = (const unsigned char *)values;
+    for(size_t i = 0; i < sizeof(values); i++) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    return hash != 0 ? hash : 1;
+}
 
+// Batch transfer: every regular file under a directory goes in the same
+// link session, each with its own START/DATA/END named by its path
+// relative to the directory
+static const char *batchRoot;
+static int batchFiles;
 
-        llwrite(buffer,7+strlen(filename));
+static int sendBatchEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)ftw;
+    if(type != FTW_F || !S_ISREG(st->st_mode)) return 0;
+    const char *name = path + strlen(batchRoot);
+    while(*name == '/') name++;
+    if(strlen(name) > 255){
+        printf("Skipping %s: name too long\n", path);
         return 0;
+    }
+    printf("Sending %s\n", name);
+    if(sendFileControlPacket(START, path, name, TRUE) < 0) return 0;
+    sendDataPacket(0, path);
+    sendFileControlPacket(END, path, name, TRUE);
+    batchFiles++;
+    return 0;
 }
-int sendDataPacket(int fd, const char *filename){
-    FILE* fd_file = fopen(filename,"rb");
+
+int sendBatch(const char *directory)
+{
+    resumeOffset = 0; // batches are not resumed
+    batchRoot = directory;
+    batchFiles = 0;
+    int result = nftw(directory, sendBatchEntry, 16, FTW_PHYS);
+    printf("Sent %d files\n", batchFiles);
+    return result;
+}
+// Transmit pipeline: a reader thread prepares (and compresses) the DATA
+// packets ahead of the link layer, which only stuffs and writes them.
+#define TX_RING_SLOTS 32
+// DATA: C N L2 L1 K O data, where L2 L1 is the size of what follows O, and
+// O the byte of the file the data starts at (K bytes, see putNumber())
+#define DATA_HEADER_MAX (4 + 1 + 8)
+// REPAIR: C F N K J L O repair, for the group of N DATA packets numbered from
+// F, the first at byte O of the file; repair J of K, as long as the longest
+// packet of the group (L bytes)
+#define REPAIR_HEADER_MAX (5 + 9 + 9)
+
+typedef struct
+{
+    unsigned char header[DATA_HEADER_MAX + 1]; // + block mode with a codec
+    int headerSize;
+    const unsigned char *data; // into the mapping of the file, sent without a copy
+    int size;                  // bytes after the header, 0 marks the end of the file
+    unsigned char *packet;     // the whole packet, when data is NULL
+} TxPacket;
+
+typedef struct
+{
+    SpscRing ring;
+    TxPacket slots[TX_RING_SLOTS];
+    unsigned char *map; // the whole file, or NULL to read it with fread()
+    off_t mapSize;
+    FILE *file;
+    int chunkSize;          // file bytes per packet
+    unsigned char *scratch; // file bytes read before compression
+    off_t position;         // next byte of the file to send
+    off_t fileBytes;        // read by the reader thread
+    off_t linkBytes;        // DATA packets given to the link layer
+    // repairs of the group of DATA packets being read
+    unsigned char *repairs[ERASURE_MAX_REPAIR];
+    int groupPackets;       // DATA packets in the group so far
+    int groupLongest;       // bytes of the longest
+    unsigned char groupFirst; // number of its first DATA packet
+    off_t groupOffset;        // byte of the file it starts at
+    off_t repairBytes;        // REPAIR packets given to the link layer
+} TxPipeline;
+
+// Adds the DATA packet in slot, for byte offset of the file, to the repairs
+// of its group
+static void addToGroup(TxPipeline *pipeline, const TxPacket *slot, off_t offset)
+{
+    int size = slot->headerSize + slot->size;
+    if(pipeline->groupPackets == 0){
+        for(int j = 0; j < groupRepairs; j++)
+            memset(pipeline->repairs[j], 0, pipeline->chunkSize + DATA_HEADER_MAX + 1);
+        pipeline->groupLongest = 0;
+        pipeline->groupFirst = slot->header[1];
+        pipeline->groupOffset = offset;
+    }
+    const unsigned char *data = (slot->data != NULL) ? slot->data : slot->packet + slot->headerSize;
+    int i = pipeline->groupPackets++;
+    for(int j = 0; j < groupRepairs; j++){
+        erasureAdd(groupRepairs, j, i, pipeline->repairs[j], slot->header, slot->headerSize);
+        erasureAdd(groupRepairs, j, i, pipeline->repairs[j] + slot->headerSize, data, slot->size);
+    }
+    if(size > pipeline->groupLongest) pipeline->groupLongest = size;
+}
+
+// Queues the REPAIR packets of the group, the first in slot
+static void sendRepairs(TxPipeline *pipeline, TxPacket *slot)
+{
+    for(int j = 0; j < groupRepairs; j++){
+        if(j > 0) slot = &pipeline->slots[ringAcquire(&pipeline->ring)];
+        unsigned char *packet = slot->packet;
+        packet[0] = REPAIR;
+        packet[1] = pipeline->groupFirst;
+        packet[2] = pipeline->groupPackets;
+        packet[3] = groupRepairs;
+        packet[4] = j;
+        int n = putNumber(packet, 5, pipeline->groupLongest);
+        n = putNumber(packet, n, pipeline->groupOffset);
+        memcpy(packet + n, pipeline->repairs[j], pipeline->groupLongest);
+        slot->header[0] = REPAIR;
+        slot->headerSize = n;
+        slot->data = NULL;
+        slot->size = pipeline->groupLongest;
+        ringPublish(&pipeline->ring);
+    }
+    pipeline->groupPackets = 0;
+}
+
+static void *readerThread(void *arg)
+{
+    TxPipeline *pipeline = arg;
+    long page = sysconf(_SC_PAGESIZE);
     int n = 0;
-    unsigned char buffer[1000];
-    unsigned int bytes_read = 0; 
-    while((bytes_read=fread(buffer+4,1,996, fd_file)) > 0){
-        buffer[0] = 0x01;
-        buffer[1] = n;
-        buffer[2] = bytes_read/256;
-        buffer[3] = bytes_read%256;
-
-        if(llwrite(buffer,bytes_read+4)==-1){
+    while(TRUE){
+        TxPacket *slot = &pipeline->slots[ringAcquire(&pipeline->ring)];
+        int size;
+        off_t offset = pipeline->position;
+        slot->headerSize = putNumber(slot->header, 4, pipeline->position);
+        int fieldsSize = slot->headerSize;
+        if(pipeline->map != NULL){
+            off_t left = pipeline->mapSize - pipeline->position;
+            size = (left < pipeline->chunkSize) ? left : pipeline->chunkSize;
+            slot->data = pipeline->map + pipeline->position;
+            // fault the pages in here rather than on the link thread
+            for(int i = 0; i < size; i += page)
+                (void)*(volatile const unsigned char *)(slot->data + i);
+        }
+        else{
+            // straight after the header, unless it is going to be compressed
+            unsigned char *buffer = (codec != CODEC_NONE) ? pipeline->scratch
+                                                         : slot->packet + slot->headerSize;
+            size = fread(buffer, 1, pipeline->chunkSize, pipeline->file);
+            slot->data = buffer;
+        }
+        pipeline->position += size;
+        pipeline->fileBytes += size;
+        slot->size = size;
+
+        if(codec != CODEC_NONE && size > 0){
+            // each block on its own, stored as it is if it does not shrink
+            slot->header[slot->headerSize++] = BLOCK_STORED;
+            int compressed = lzCompress(slot->data, size, slot->packet + slot->headerSize, size - 1);
+            if(compressed >= 0){
+                slot->header[fieldsSize] = BLOCK_LZ;
+                slot->data = NULL;
+                slot->size = compressed;
+            }
+        }
+        int length = slot->headerSize - fieldsSize + slot->size;
+        slot->header[0] = DATA;
+        slot->header[1] = n++;
+        slot->header[2] = length/256;
+        slot->header[3] = length%256;
+
+        // only data in the mapping is sent from where it is
+        if(pipeline->map == NULL && slot->data != NULL){
+            if(slot->data != slot->packet + slot->headerSize)
+                memcpy(slot->packet + slot->headerSize, slot->data, slot->size);
+            slot->data = NULL;
+        }
+        if(slot->data == NULL) memcpy(slot->packet, slot->header, slot->headerSize);
+
+        int last = size == 0;
+        if(groupRepairs > 0 && !last) addToGroup(pipeline, slot, offset);
+        else if(groupRepairs > 0 && pipeline->groupPackets > 0){
+            // the last group, maybe shorter, before the end of the file
+            sendRepairs(pipeline, slot);
+            slot = &pipeline->slots[ringAcquire(&pipeline->ring)];
+            slot->size = 0;
+        }
+        ringPublish(&pipeline->ring);
+        if(last) return NULL;
+        if(groupRepairs > 0 && pipeline->groupPackets == groupSize)
+            sendRepairs(pipeline, &pipeline->slots[ringAcquire(&pipeline->ring)]);
+    }
+}
+
+// Maps the file (MADV_SEQUENTIAL) so packets are stuffed straight from its
+// pages, and read again from them for retransmissions.
+// Falls back to fread() for files that cannot be mapped (pipes, empty files).
+int openTxSource(TxPipeline *pipeline, const char *filename)
+{
+    pipeline->map = NULL;
+    pipeline->file = NULL;
+    pipeline->scratch = NULL;
+    pipeline->position = resumeOffset;
+    pipeline->fileBytes = 0;
+    pipeline->linkBytes = 0;
+    pipeline->groupPackets = 0;
+    pipeline->repairBytes = 0;
+    int file = open(filename, O_RDONLY);
+    if(file < 0) return -1;
+    struct stat st;
+    unsigned char *map = MAP_FAILED;
+    if(fstat(file, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(map != MAP_FAILED){
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        pipeline->map = map;
+        pipeline->mapSize = st.st_size;
+        close(file);
+    }
+    else{
+        pipeline->file = fdopen(file, "rb");
+        if(resumeOffset > 0) fseeko(pipeline->file, resumeOffset, SEEK_SET);
+        if(codec != CODEC_NONE) pipeline->scratch = malloc(pipeline->chunkSize);
+    }
+    // packets are built in the slots unless sent from the mapping
+    for(int i = 0; i < TX_RING_SLOTS; i++){
+        pipeline->slots[i].packet = NULL;
+        if(pipeline->map == NULL || codec != CODEC_NONE || groupRepairs > 0)
+            pipeline->slots[i].packet = malloc(pipeline->chunkSize + DATA_HEADER_MAX + 1 + REPAIR_HEADER_MAX);
+    }
+    for(int j = 0; j < groupRepairs; j++)
+        pipeline->repairs[j] = malloc(pipeline->chunkSize + DATA_HEADER_MAX + 1);
+    return 0;
+}
+
+void closeTxSource(TxPipeline *pipeline)
+{
+    for(int i = 0; i < TX_RING_SLOTS; i++) free(pipeline->slots[i].packet);
+    for(int j = 0; j < groupRepairs; j++) free(pipeline->repairs[j]);
+    free(pipeline->scratch);
+    if(pipeline->map != NULL) munmap(pipeline->map, pipeline->mapSize);
+    else fclose(pipeline->file);
+}
+
+double elapsedSeconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// File bytes against the bytes of the DATA packets that carried them, and
+// their ratio when codec compressed them
+void printTransferStatistics(off_t fileBytes, off_t linkBytes, int codec, double seconds)
+{
+    printf("File bytes: %lld, DATA packet bytes: %lld", (long long)fileBytes, (long long)linkBytes);
+    if(codec != CODEC_NONE && linkBytes > 0)
+        printf(", compression ratio: %.2f", (double)fileBytes / linkBytes);
+    printf("\n");
+    if(seconds > 0) printf("Goodput: %.0f bit/s\n", fileBytes * 8 / seconds);
+}
+
+int sendDataPacket(int fd, const char *filename){
+    (void)fd; // the link layer has the port
+    static TxPipeline pipeline;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // one packet fills the largest frame agreed in llopen(), and so does a
+    // REPAIR packet as long as it
+    pipeline.chunkSize = llgetoptions().maxPayload - DATA_HEADER_MAX - (codec != CODEC_NONE)
+                         - (groupRepairs > 0 ? REPAIR_HEADER_MAX : 0);
+    if(openTxSource(&pipeline, filename) < 0) return -1;
+    ringInit(&pipeline.ring, TX_RING_SLOTS);
+
+    pthread_t reader;
+    pthread_create(&reader, NULL, readerThread, &pipeline);
+    while(TRUE){
+        TxPacket *slot = &pipeline.slots[ringPeek(&pipeline.ring)];
+        if(slot->size == 0) break;
+        int written = (slot->data != NULL)
+            ? llwritepacket(slot->header, slot->headerSize, slot->data, slot->size)
+            : llwrite(slot->packet, slot->headerSize + slot->size);
+        if(written==-1){
             printf("Max number tries reached ");
             exit(-1);
         }
-        n++;
+        if(slot->header[0] == REPAIR) pipeline.repairBytes += slot->headerSize + slot->size;
+        else pipeline.linkBytes += slot->headerSize + slot->size;
+        ringRelease(&pipeline.ring);
     }
+    pthread_join(reader, NULL);
 
-    fclose(fd_file);
-    return 0;
+    // frames in flight still point into the mapping
+    if(lldrain() == -1){
+        printf("Max number tries reached ");
+        exit(-1);
     }
+    printTransferStatistics(pipeline.fileBytes, pipeline.linkBytes, codec, elapsedSeconds(&start));
+    if(groupRepairs > 0)
+        printf("REPAIR packet bytes: %lld (%d for every %d DATA packets)\n",
+               (long long)pipeline.repairBytes, groupRepairs, groupSize);
+    closeTxSource(&pipeline);
+    return 0;
+}
     
+// Receive pipeline: the calling thread runs the link layer and queues the
+// DATA packets, a writer thread saves them in batches, so the RR of a frame
+// never waits for the disk.
+#define RX_RING_SLOTS 32
+#define RX_BATCH 16
+#define SAVED_RANGES 64 // saved beyond a hole, tracked for the journal
+
+typedef struct
+{
+    unsigned char *packet; // filled by llread()
+    int header;            // bytes before the data
+    int size;              // data bytes after the header, -1 ends the file
+    off_t offset;          // position of the data in the file
+} RxPacket;
+
+typedef struct
+{
+    off_t start, end;
+} FileRange;
+
+typedef struct
+{
+    SpscRing ring;
+    RxPacket slots[RX_RING_SLOTS];
+    DiskWriter disk;
+    int codec;                       // from the START packet
+    unsigned char *blocks[RX_BATCH]; // decompressed blocks of a batch
+    int blockSize;
+    off_t written;                   // end of the furthest data saved by the writer thread
+    off_t savedBytes;                // bytes it saved, without a resumed prefix
+    // end of the data saved with no hole before it (DATA packets lost
+    // without ARQ, or rebuilt from REPAIR after later ones), and the ranges
+    // saved past the first hole, sorted and apart
+    off_t contiguous;
+    FileRange saved[SAVED_RANGES];
+    int savedCount;
+    int journal;                     // journal of the file, -1 if none
+    unsigned long long transferId;
+    off_t journalled;                // bytes the journal says are on disk
+    atomic_int failed;               // a write failed, the transfer stops
+} RxPipeline;
+
+// Resumable transfers: the receiver keeps next to the file a journal with
+// the transfer ID and how many bytes of it are safely on disk
+#define JOURNAL_INTERVAL (1 << 20) // bytes saved between journal updates
+
+void journalPath(char *path, int size, const char *filename)
+{
+    snprintf(path, size, "%s.journal", filename);
+}
+
+// Syncs the data written so far, then records in the journal where the
+// file stops being complete. The journal is left alone if the sync fails.
+void commitJournal(RxPipeline *pipeline)
+{
+    if(writerSync(&pipeline->disk) < 0){
+        perror("commitJournal() - Error on fdatasync()");
+        return;
+    }
+    char line[64];
+    int size = snprintf(line, sizeof(line), "%016llx %020lld\n",
+                        pipeline->transferId, (long long)pipeline->contiguous);
+    if(pwrite(pipeline->journal, line, size, 0) != size) perror("commitJournal()");
+    pipeline->journalled = pipeline->contiguous;
+}
+
+// Records bytes [start, end) of the file as saved, merged into the ranges
+// past the first hole, and moves contiguous up to the next hole. With
+// SAVED_RANGES holes open the furthest range is forgotten instead, which
+// only makes a resume send it again.
+void markSaved(RxPipeline *pipeline, off_t start, off_t end)
+{
+    FileRange *saved = pipeline->saved;
+    int count = pipeline->savedCount;
+    if(end <= pipeline->contiguous) return;
+    if(start <= pipeline->contiguous){
+        pipeline->contiguous = end;
+    }
+    else{
+        // ranges i..j-1 overlap or touch [start, end) and become one
+        int i = 0;
+        while(i < count && saved[i].end < start) i++;
+        int j = i;
+        for(; j < count && saved[j].start <= end; j++){
+            if(saved[j].start < start) start = saved[j].start;
+            if(saved[j].end > end) end = saved[j].end;
+        }
+        if(j == i){
+            if(count == SAVED_RANGES){
+                if(i == count) return;
+                count--;
+            }
+            memmove(&saved[i + 1], &saved[i], (count - i) * sizeof(FileRange));
+            count++;
+        }
+        else{
+            memmove(&saved[i + 1], &saved[j], (count - j) * sizeof(FileRange));
+            count -= j - i - 1;
+        }
+        saved[i].start = start;
+        saved[i].end = end;
+    }
+    // ranges the complete part now reaches
+    int reached = 0;
+    while(reached < count && saved[reached].start <= pipeline->contiguous){
+        if(saved[reached].end > pipeline->contiguous) pipeline->contiguous = saved[reached].end;
+        reached++;
+    }
+    memmove(saved, &saved[reached], (count - reached) * sizeof(FileRange));
+    pipeline->savedCount = count - reached;
+}
+
+int readJournal(const char *filename, unsigned long long *id, unsigned long long *offset)
+{
+    char path[4096];
+    journalPath(path, sizeof(path), filename);
+    FILE *journal = fopen(path, "r");
+    if(journal == NULL) return -1;
+    int valid = fscanf(journal, "%llx %llu", id, offset) == 2;
+    fclose(journal);
+    // the file must still hold what the journal says
+    struct stat st;
+    if(!valid || stat(filename, &st) < 0 || (unsigned long long)st.st_size < *offset){
+        *id = 0;
+        *offset = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Saves the packets queued by the receiver. Their bytes count as saved
+// (for the journal) only once their write completed; after a failed write
+// the packets are only taken, and the receiver stops the transfer.
+static void *writerThread(void *arg)
+{
+    RxPipeline *pipeline = arg;
+    struct iovec iov[RX_BATCH];
+    FileRange runs[RX_BATCH];
+    int done = FALSE;
+    while(!done){
+        unsigned int first = ringPeek(&pipeline->ring);
+        unsigned int ready = ringReady(&pipeline->ring);
+        if(ready > RX_BATCH) ready = RX_BATCH;
+
+        // each packet goes at its offset, consecutive ones in a single write
+        int count = 0, runCount = 0, result = 0;
+        off_t offset = 0, end = 0;
+        unsigned int taken = 0;
+        while(taken < ready){
+            RxPacket *slot = &pipeline->slots[(first + taken) % RX_RING_SLOTS];
+            unsigned char *block = pipeline->blocks[taken];
+            taken++;
+            if(slot->size < 0){
+                done = TRUE;
+                break;
+            }
+            if(atomic_load(&pipeline->failed)) continue;
+            unsigned char *data = slot->packet + slot->header;
+            int size = slot->size;
+            if(pipeline->codec != CODEC_NONE){
+                if(size < 1) continue;
+                int mode = *data++;
+                size--;
+                if(mode == BLOCK_LZ){
+                    size = lzDecompress(data, size, block, pipeline->blockSize);
+                    data = block;
+                }
+                if(size < 0){
+                    printf("Corrupt compressed block\n");
+                    continue;
+                }
+            }
+            if(count > 0 && slot->offset != end){
+                if(writerWrite(&pipeline->disk, iov, count, offset) < 0) result = -1;
+                count = 0;
+            }
+            if(count == 0){
+                offset = end = slot->offset;
+                runs[runCount].start = offset;
+                runCount++;
+            }
+            iov[count].iov_base = data;
+            iov[count].iov_len = size;
+            end += size;
+            runs[runCount - 1].end = end;
+            count++;
+        }
+        if(count > 0 && writerWrite(&pipeline->disk, iov, count, offset) < 0) result = -1;
+        // the writes read the slots and blocks of the batch until completed
+        if(writerFlush(&pipeline->disk) < 0) result = -1;
+        if(result < 0){
+            // which of the batch's writes failed is unknown, none is saved
+            atomic_store(&pipeline->failed, TRUE);
+        }
+        else{
+            for(int i = 0; i < runCount; i++){
+                markSaved(pipeline, runs[i].start, runs[i].end);
+                pipeline->savedBytes += runs[i].end - runs[i].start;
+                if(runs[i].end > pipeline->written) pipeline->written = runs[i].end;
+            }
+            if(pipeline->journal >= 0 && pipeline->contiguous - pipeline->journalled >= JOURNAL_INTERVAL)
+                commitJournal(pipeline);
+        }
+        for(unsigned int i = 0; i < taken; i++) ringRelease(&pipeline->ring);
+    }
+    return NULL;
+}
+
+// Receiver side of erasure coding: the last DATA packets are held by their
+// number until the REPAIR packets of their group tell whether any was lost
+#define HELD_PACKETS (2 * ERASURE_MAX_GROUP)
+
+typedef struct
+{
+    unsigned char *held[HELD_PACKETS]; // DATA packet number % HELD_PACKETS
+    int heldSize[HELD_PACKETS];        // 0 for none
+    unsigned char heldNumber[HELD_PACKETS];
+    off_t heldOffset[HELD_PACKETS];
+    unsigned char *repairs[ERASURE_MAX_REPAIR]; // of the current group
+    int repairIndex[ERASURE_MAX_REPAIR];
+    int repairCount;
+    unsigned char *rebuilt[ERASURE_MAX_REPAIR];
+    // the current group, as its REPAIR packets describe it
+    int open;
+    unsigned char first;
+    int packets, k, longest;
+    off_t offset;
+    int missing; // DATA packets of the group not received, -1 before counted
+    int done;    // nothing was missing or it was rebuilt
+    // of the file
+    int groups, rebuiltPackets, lost, worst, largest;
+} RepairReceiver;
+
+void repairInit(RepairReceiver *repair, int maxPayload)
+{
+    for(int i = 0; i < HELD_PACKETS; i++) repair->held[i] = malloc(maxPayload);
+    for(int j = 0; j < ERASURE_MAX_REPAIR; j++){
+        repair->repairs[j] = malloc(maxPayload);
+        repair->rebuilt[j] = malloc(maxPayload);
+    }
+}
+
+void repairFree(RepairReceiver *repair)
+{
+    for(int i = 0; i < HELD_PACKETS; i++) free(repair->held[i]);
+    for(int j = 0; j < ERASURE_MAX_REPAIR; j++){
+        free(repair->repairs[j]);
+        free(repair->rebuilt[j]);
+    }
+}
+
+// Forgets the packets and statistics of the last file
+void repairReset(RepairReceiver *repair)
+{
+    for(int i = 0; i < HELD_PACKETS; i++) repair->heldSize[i] = 0;
+    repair->open = FALSE;
+    repair->groups = repair->rebuiltPackets = repair->lost = repair->worst = repair->largest = 0;
+}
+
+void holdPacket(RepairReceiver *repair, const unsigned char *packet, int size, off_t offset)
+{
+    int i = packet[1] % HELD_PACKETS;
+    memcpy(repair->held[i], packet, size);
+    repair->heldSize[i] = size;
+    repair->heldNumber[i] = packet[1];
+    repair->heldOffset[i] = offset;
+}
+
+// Packets of the group still missing once it ends
+void closeGroup(RepairReceiver *repair)
+{
+    if(!repair->open) return;
+    repair->groups++;
+    if(!repair->done && repair->missing > 0) repair->lost += repair->missing;
+    repair->open = FALSE;
+}
+
+// The group sizes the statistics of the file call for: enough repairs for
+// the worst group seen, and no losses without any
+void printRepairStatistics(const RepairReceiver *repair)
+{
+    printf("Groups: %d, DATA packets rebuilt: %d, lost: %d, most missing in a group: %d\n",
+           repair->groups, repair->rebuiltPackets, repair->lost, repair->worst);
+    int n = repair->largest;
+    int k = repair->worst;
+    if(k > ERASURE_MAX_REPAIR) k = ERASURE_MAX_REPAIR;
+    if(n + k > ERASURE_MAX_GROUP) n = ERASURE_MAX_GROUP - k;
+    if(n > 0) printf("Suggested LL_REPAIR=%d,%d\n", n, k);
+}
+
+/**
+ * @brief Takes a REPAIR packet and, once a group has as many repairs as
+ * packets lost, rebuilds them and queues them for the writer thread.
+ *
+ * @return Number of DATA bytes rebuilt
+ */
+int receiveRepair(RepairReceiver *repair, SpscRing *ring, RxPacket *slots,
+                  const unsigned char *packet, int size, int maxPayload)
+{
+    if(size < 7 || packet[5] > 8 || 7 + packet[5] > size || 7 + packet[5] + packet[6 + packet[5]] > size)
+        return 0;
+    int header = 6 + packet[5];
+    int longest = getNumber(packet + 6, packet[5]);
+    off_t offset = getNumber(packet + header + 1, packet[header]);
+    header += 1 + packet[header];
+    int n = packet[2], k = packet[3], j = packet[4];
+    if(n < 1 || k < 1 || k > ERASURE_MAX_REPAIR || n + k > ERASURE_MAX_GROUP || j >= k ||
+       longest > maxPayload || header + longest > size)
+        return 0;
+
+    if(!repair->open || packet[1] != repair->first || offset != repair->offset){
+        closeGroup(repair);
+        repair->open = TRUE;
+        repair->first = packet[1];
+        repair->packets = n;
+        repair->k = k;
+        repair->longest = longest;
+        repair->offset = offset;
+        repair->repairCount = 0;
+        repair->missing = -1;
+        repair->done = FALSE;
+        if(n > repair->largest) repair->largest = n;
+    }
+    if(repair->done || n != repair->packets || k != repair->k || longest != repair->longest) return 0;
+    for(int r = 0; r < repair->repairCount; r++){
+        if(repair->repairIndex[r] == j) return 0;
+    }
+    memcpy(repair->repairs[repair->repairCount], packet + header, longest);
+    repair->repairIndex[repair->repairCount++] = j;
+
+    // the packets received, padded to the longest
+    unsigned char *packets[ERASURE_MAX_GROUP];
+    int present[ERASURE_MAX_GROUP];
+    int missing = 0;
+    for(int i = 0; i < n; i++){
+        unsigned char number = repair->first + i;
+        int h = number % HELD_PACKETS;
+        present[i] = repair->heldSize[h] > 0 && repair->heldNumber[h] == number &&
+                     repair->heldOffset[h] >= offset && repair->heldSize[h] <= longest;
+        if(present[i]){
+            packets[i] = repair->held[h];
+            memset(packets[i] + repair->heldSize[h], 0, longest - repair->heldSize[h]);
+        }
+        else if(missing < ERASURE_MAX_REPAIR) packets[i] = repair->rebuilt[missing++];
+        else missing++;
+    }
+    repair->missing = missing;
+    if(missing > repair->worst) repair->worst = missing;
+    if(missing == 0) repair->done = TRUE;
+    if(repair->done || missing > repair->repairCount) return 0;
+    if(erasureRebuild(k, n, packets, present, repair->repairs, repair->repairIndex,
+                      repair->repairCount, longest) < 0)
+        return 0;
+    repair->done = TRUE;
+
+    int bytes = 0;
+    for(int i = 0; i < n; i++){
+        const unsigned char *rebuilt = packets[i];
+        if(present[i] || rebuilt[0] != DATA || rebuilt[4] > 8) continue;
+        int dataSize = rebuilt[2]*256 + rebuilt[3];
+        if(5 + rebuilt[4] + dataSize > longest) continue;
+        RxPacket *slot = &slots[ringAcquire(ring)];
+        memcpy(slot->packet, rebuilt, 5 + rebuilt[4] + dataSize);
+        slot->header = 5 + rebuilt[4];
+        slot->size = dataSize;
+        slot->offset = getNumber(rebuilt + 5, rebuilt[4]);
+        ringPublish(ring);
+        repair->rebuiltPackets++;
+        bytes += slot->header + dataSize;
+    }
+    return bytes;
+}
+
+typedef struct
+{
+    off_t size;
+    off_t offset; // first byte of the file in the DATA packets
+    char name[256];
+    int codec;
+    int batch; // more files follow in the same session
+    int repair; // REPAIR packets follow the groups of DATA packets
+} StartPacket;
+
+// TLVs of the START packet: file size (T=0x00), name (T=0x01), codec
+// (T=0x02), batch (T=0x03), offset of the first DATA byte (T=0x05) and
+// group size and REPAIR packets per group (T=0x06)
+void parseStart(const unsigned char *packet, int size, StartPacket *start)
+{
+    start->size = 0;
+    start->offset = 0;
+    start->name[0] = '\0';
+    start->codec = CODEC_NONE;
+    start->batch = FALSE;
+    start->repair = FALSE;
+    for(int i = 1; i + 1 < size && i + 2 + packet[i+1] <= size; i += 2 + packet[i+1]){
+        int length = packet[i+1];
+        const unsigned char *value = packet + i + 2;
+        switch(packet[i]){
+            case 0x00:
+                start->size = getNumber(value, length);
+                break;
+            case 0x01:
+                memcpy(start->name, value, length);
+                start->name[length] = '\0';
+                break;
+            case 0x02:
+                if(length == 1) start->codec = value[0];
+                break;
+            case 0x03:
+                if(length == 1) start->batch = value[0];
+                break;
+            case 0x05:
+                start->offset = getNumber(value, length);
+                break;
+            case 0x06:
+                if(length == 2) start->repair = value[1] > 0;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Where a file of a batch is saved: name under the directory given
+ * as the receiver's filename, creating the directories on the way.
+ *
+ * @return -1 if name could escape the directory
+ */
+int batchPath(char *path, int size, const char *directory, const char *name)
+{
+    if(name[0] == '\0' || name[0] == '/') return -1;
+    for(const char *part = name; part != NULL; part = strchr(part, '/')){
+        if(*part == '/') part++;
+        if(strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0')) return -1;
+    }
+    if(snprintf(path, size, "%s/%s", directory, name) >= size) return -1;
+    for(char *slash = strchr(path + strlen(directory) + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')){
+        *slash = '\0';
+        if(mkdir(path, 0755) < 0 && errno != EEXIST) perror(path);
+        *slash = '/';
+    }
+    return 0;
+}
+
+// Waits for the writer thread to save what was queued and closes the file.
+// The journal is kept if the transfer did not reach END, for a resume, and
+// the file cut where the journal says it stops being complete.
+void finishFile(RxPipeline *pipeline, pthread_t writer, off_t received,
+                const struct timespec *start, const char *filename, int complete)
+{
+    RxPacket *slot = &pipeline->slots[ringAcquire(&pipeline->ring)];
+    slot->size = -1;
+    ringPublish(&pipeline->ring);
+    pthread_join(writer, NULL);
+    if(atomic_load(&pipeline->failed)){
+        printf("Writing the file failed, it stops at byte %lld\n", (long long)pipeline->contiguous);
+        complete = FALSE;
+    }
+    if(pipeline->journal >= 0){
+        if(!complete) commitJournal(pipeline);
+        close(pipeline->journal);
+        if(complete){
+            char path[4096];
+            journalPath(path, sizeof(path), filename);
+            unlink(path);
+        }
+    }
+    writerClose(&pipeline->disk, complete ? pipeline->written : pipeline->contiguous);
+    printTransferStatistics(pipeline->savedBytes, received, pipeline->codec, elapsedSeconds(start));
+}
+
 int receivePacket(int fd, const char * filename){
-    unsigned char buffer[2000];
-    int n = 0, n_aux;
-    int offset_needed = 0;
-    FILE* gif_fd;
-    unsigned int file_size, append_size, sizeRead;
+    static RxPipeline pipeline;
+    static RepairReceiver repair;
+    int repairing = FALSE;
+    int maxPayload = llgetoptions().maxPayload;
+    for(int i = 0; i < RX_RING_SLOTS; i++)
+        pipeline.slots[i].packet = malloc(maxPayload);
+    // a block never decompresses to more than a full packet
+    pipeline.blockSize = maxPayload;
+    for(int i = 0; i < RX_BATCH; i++) pipeline.blocks[i] = malloc(maxPayload);
+    ringInit(&pipeline.ring, RX_RING_SLOTS);
+    // one io_uring for every file of a batch
+    writerInit(&pipeline.disk);
+
+    pthread_t writer;
+    int writing = FALSE;
+    int batch = FALSE;
+    int files = 0;
+    off_t received = 0;
+    struct timespec start;
+    int sizeRead;
     while(1){
+        // llread() straight into the next free slot of the queue
+        RxPacket *slot = &pipeline.slots[ringAcquire(&pipeline.ring)];
+        unsigned char *buffer = slot->packet;
         sizeRead = llread(buffer);
+        if(writing && atomic_load(&pipeline.failed)) break;
+        if(sizeRead < 0){
+            // a batch ends with the DISC after its last file
+            if(!batch || writing) printf("Transmitter disconnected before END\n");
+            break;
+        }
         
-        if(buffer[0] == START){
-            gif_fd = fopen(filename, "wb");
-            file_size = buffer[3]<<8 | buffer[4];
-        }
-        else if(buffer[0] == DATA && sizeRead > 0){
-            append_size = buffer[2]*256 + buffer[3];
-            fwrite(buffer+4, 1,append_size, gif_fd);  
-            if (buffer[1] == n){
-                n++;
+        if(buffer[0] == START && !writing){
+            StartPacket startPacket;
+            parseStart(buffer, sizeRead, &startPacket);
+            if(startPacket.codec > CODEC_LZ){
+                printf("Unknown codec %d\n", startPacket.codec);
+                break;
+            }
+            char path[4096];
+            const char *output = filename;
+            batch = startPacket.batch;
+            if(batch){
+                if(files == 0 && mkdir(filename, 0755) < 0 && errno != EEXIST) perror(filename);
+                if(batchPath(path, sizeof(path), filename, startPacket.name) < 0){
+                    printf("Refusing file name %s\n", startPacket.name);
+                    break;
+                }
+                output = path;
+                printf("Receiving %s\n", startPacket.name);
+            }
+            // a resumed transfer continues the file it left
+            if(writerOpen(&pipeline.disk, output, startPacket.size, startPacket.offset > 0) < 0) break;
+            pipeline.codec = startPacket.codec;
+            pipeline.written = startPacket.offset;
+            pipeline.savedBytes = 0;
+            pipeline.contiguous = startPacket.offset;
+            pipeline.savedCount = 0;
+            atomic_store(&pipeline.failed, FALSE);
+            pipeline.journal = -1;
+            pipeline.transferId = llgetoptions().transferId;
+            if(!batch && pipeline.transferId != 0){
+                char path[4096];
+                journalPath(path, sizeof(path), filename);
+                pipeline.journal = open(path, O_WRONLY | O_CREAT, 0644);
+                if(pipeline.journal >= 0) commitJournal(&pipeline);
+            }
+            repairing = startPacket.repair;
+            if(repairing){
+                if(repair.held[0] == NULL) repairInit(&repair, maxPayload);
+                repairReset(&repair);
             }
+            received = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            pthread_create(&writer, NULL, writerThread, &pipeline);
+            writing = TRUE;
         }
-        else if(buffer[0] == END){
+        else if(buffer[0] == DATA && sizeRead > 4 && writing){
+            slot->header = 5 + buffer[4];
+            slot->size = buffer[2]*256 + buffer[3];
+            if(buffer[4] > 8 || slot->header + slot->size > sizeRead) continue;
+            slot->offset = getNumber(buffer + 5, buffer[4]);
+            received += sizeRead;
+            if(repairing) holdPacket(&repair, buffer, sizeRead, slot->offset);
+            ringPublish(&pipeline.ring);
+        }
+        else if(buffer[0] == REPAIR && writing && repairing){
+            received += receiveRepair(&repair, &pipeline.ring, pipeline.slots, buffer, sizeRead, maxPayload);
+        }
+        else if(buffer[0] == END && writing){
             
             printf("END\n");
-            break;
+            finishFile(&pipeline, writer, received, &start, filename, TRUE);
+            if(repairing){
+                closeGroup(&repair);
+                printRepairStatistics(&repair);
+            }
+            writing = FALSE;
+            files++;
+            if(!batch) break;
         }
     }
-    fclose(gif_fd);
+    if(writing) finishFile(&pipeline, writer, received, &start, filename, FALSE);
+    if(batch) printf("Received %d files\n", files);
+    for(int i = 0; i < RX_RING_SLOTS; i++) free(pipeline.slots[i].packet);
+    for(int i = 0; i < RX_BATCH; i++) free(pipeline.blocks[i]);
+    writerFree(&pipeline.disk);
+    if(repair.held[0] != NULL){
+        repairFree(&repair);
+        repair.held[0] = NULL;
+    }
     return fd;
-}
\ No newline at end of file
+}
@@ -0,0 +1,141 @@
+// Byte stuffing implementation
+
+#include "byte_stuffing.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define FLAG 0x7e
+#define ESC 0x7D
+#define IS_SPECIAL(byte) ((byte) == FLAG || (byte) == ESC)
+
+/**
+ * @brief Copies the clean run data[run..end) and escapes data[end]
+ *
+ * @return new size of the output
+ */
+static inline int escapeAt(unsigned char *dst, int n, const unsigned char *data, int *run, int end)
+{
+    memcpy(dst + n, data + *run, end - *run);
+    n += end - *run;
+    dst[n++] = ESC;
+    dst[n++] = data[end];
+    *run = end + 1;
+    return n;
+}
+
+// Scalar tail shared by every version: stuffs data[i..size) and flushes
+// the pending clean run
+static int finishStuffing(unsigned char *dst, int n, const unsigned char *data,
+                          int run, int i, int size, unsigned char *BCC2)
+{
+    unsigned char bcc = *BCC2;
+    for(; i < size; i++){
+        bcc ^= data[i];
+        if(IS_SPECIAL(data[i])) n = escapeAt(dst, n, data, &run, i);
+    }
+    *BCC2 = bcc;
+    memcpy(dst + n, data + run, size - run);
+    return n + size - run;
+}
+
+static int appendBCC2(unsigned char *dst, int n, unsigned char BCC2)
+{
+    if(IS_SPECIAL(BCC2)) dst[n++] = ESC;
+    dst[n++] = BCC2;
+    return n;
+}
+
+static int stuffBytesScalar(unsigned char *dst, const unsigned char *data, int size, unsigned char *bcc)
+{
+    *bcc = 0;
+    return finishStuffing(dst, 0, data, 0, 0, size, bcc);
+}
+
+int stuffDataScalar(unsigned char *dst, const unsigned char *data, int size)
+{
+    unsigned char BCC2;
+    int n = stuffBytesScalar(dst, data, size, &BCC2);
+    return appendBCC2(dst, n, BCC2);
+}
+
+#ifdef HAVE_X86_SIMD
+
+static int stuffBytesSSE2(unsigned char *dst, const unsigned char *data, int size, unsigned char *bcc)
+{
+    const __m128i flag = _mm_set1_epi8(FLAG);
+    const __m128i esc = _mm_set1_epi8(ESC);
+    __m128i acc = _mm_setzero_si128();
+    int i = 0, run = 0, n = 0;
+
+    for(; i + 16 <= size; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        acc = _mm_xor_si128(acc, v);
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, esc)));
+        for(; mask != 0; mask &= mask - 1)
+            n = escapeAt(dst, n, data, &run, i + __builtin_ctz(mask));
+    }
+
+    unsigned char lanes[16];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    *bcc = 0;
+    for(int j = 0; j < 16; j++) *bcc ^= lanes[j];
+    return finishStuffing(dst, n, data, run, i, size, bcc);
+}
+
+__attribute__((target("avx2")))
+static int stuffBytesAVX2(unsigned char *dst, const unsigned char *data, int size, unsigned char *bcc)
+{
+    const __m256i flag = _mm256_set1_epi8(FLAG);
+    const __m256i esc = _mm256_set1_epi8(ESC);
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0, run = 0, n = 0;
+
+    for(; i + 32 <= size; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        acc = _mm256_xor_si256(acc, v);
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, flag), _mm256_cmpeq_epi8(v, esc)));
+        for(; mask != 0; mask &= mask - 1)
+            n = escapeAt(dst, n, data, &run, i + __builtin_ctz(mask));
+    }
+
+    unsigned char lanes[32];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    *bcc = 0;
+    for(int j = 0; j < 32; j++) *bcc ^= lanes[j];
+    return finishStuffing(dst, n, data, run, i, size, bcc);
+}
+
+static int (*stuff)(unsigned char *, const unsigned char *, int, unsigned char *);
+static pthread_once_t stuffOnce = PTHREAD_ONCE_INIT;
+
+static void chooseStuffing()
+{
+    stuff = __builtin_cpu_supports("avx2") ? stuffBytesAVX2 : stuffBytesSSE2;
+}
+
+#endif
+
+int stuffBytes(unsigned char *dst, const unsigned char *data, int size, unsigned char *bcc)
+{
+#ifdef HAVE_X86_SIMD
+    // links on other threads may stuff frames at the same time
+    pthread_once(&stuffOnce, chooseStuffing);
+    return stuff(dst, data, size, bcc);
+#else
+    return stuffBytesScalar(dst, data, size, bcc);
+#endif
+}
+
+int stuffData(unsigned char *dst, const unsigned char *data, int size)
+{
+    unsigned char BCC2;
+    int n = stuffBytes(dst, data, size, &BCC2);
+    return appendBCC2(dst, n, BCC2);
+}
@@ -0,0 +1,129 @@
+// Compression implementation
+
+#include "compression.h"
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline unsigned int hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes the extra length bytes of a length that did not fit in the token
+static inline unsigned char *putLength(unsigned char *op, int length)
+{
+    for(; length >= 255; length -= 255) *op++ = 255;
+    *op++ = length;
+    return op;
+}
+
+// Upper bound of the output of a sequence with literals literal bytes
+static inline int sequenceBound(int literals)
+{
+    return 1 + literals + literals / 255 + 1 + 2 + 8;
+}
+
+int lzCompress(const unsigned char *src, int size, unsigned char *dst, int capacity)
+{
+    // positions of the last 4-byte sequences seen, by hash
+    int table[1 << HASH_BITS];
+    for(int i = 0; i < (1 << HASH_BITS); i++) table[i] = -1;
+
+    const unsigned char *end = src + size;
+    unsigned char *op = dst;
+    unsigned char *limit = dst + capacity;
+    int anchor = 0; // first literal not written yet
+    int i = 0;
+    while(i + MIN_MATCH <= size){
+        uint32_t sequence = read32(src + i);
+        unsigned int h = hash(sequence);
+        int candidate = table[h];
+        table[h] = i;
+        if(candidate < 0 || i - candidate > MAX_OFFSET || read32(src + candidate) != sequence){
+            i++;
+            continue;
+        }
+
+        int length = MIN_MATCH;
+        while(src + i + length < end && src[candidate + length] == src[i + length]) length++;
+
+        int literals = i - anchor;
+        if(op + sequenceBound(literals) + length / 255 > limit) return -1;
+        unsigned char *token = op++;
+        *token = (literals < 15 ? literals : 15) << 4;
+        if(literals >= 15) op = putLength(op, literals - 15);
+        memcpy(op, src + anchor, literals);
+        op += literals;
+        *op++ = (i - candidate) & 0xFF;
+        *op++ = (i - candidate) >> 8;
+        int extra = length - MIN_MATCH;
+        *token |= (extra < 15 ? extra : 15);
+        if(extra >= 15) op = putLength(op, extra - 15);
+
+        i += length;
+        anchor = i;
+    }
+
+    int literals = size - anchor;
+    if(op + sequenceBound(literals) > limit) return -1;
+    *op++ = (literals < 15 ? literals : 15) << 4;
+    if(literals >= 15) op = putLength(op, literals - 15);
+    memcpy(op, src + anchor, literals);
+    op += literals;
+    return op - dst;
+}
+
+// Reads the extra length bytes after a token field of 15
+static inline int getLength(const unsigned char **ip, const unsigned char *end, int *length)
+{
+    unsigned char byte;
+    do{
+        if(*ip >= end) return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    }while(byte == 255);
+    return 0;
+}
+
+int lzDecompress(const unsigned char *src, int size, unsigned char *dst, int capacity)
+{
+    const unsigned char *ip = src;
+    const unsigned char *end = src + size;
+    unsigned char *op = dst;
+    unsigned char *limit = dst + capacity;
+    while(ip < end){
+        unsigned char token = *ip++;
+        int literals = token >> 4;
+        if(literals == 15 && getLength(&ip, end, &literals) < 0) return -1;
+        if(literals > end - ip || literals > limit - op) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if(ip == end) break; // last sequence
+
+        if(end - ip < 2) return -1;
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        int length = token & 0x0F;
+        if(length == 15 && getLength(&ip, end, &length) < 0) return -1;
+        length += MIN_MATCH;
+        if(offset == 0 || offset > op - dst || length > limit - op) return -1;
+        const unsigned char *match = op - offset;
+        if(offset >= length) memcpy(op, match, length);
+        // byte by byte: the match overlaps what it copies
+        else for(int k = 0; k < length; k++) op[k] = match[k];
+        op += length;
+    }
+    return op - dst;
+}
@@ -0,0 +1,278 @@
+// Disk writer implementation
+
+#define _GNU_SOURCE
+#include "disk_writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#define FALSE 0
+#define TRUE 1
+
+#ifdef HAVE_IO_URING
+
+#define RING_ENTRIES WRITER_QUEUE
+
+static void ringDestroy(DiskWriter *writer)
+{
+    if(writer->sqes != NULL) munmap(writer->sqes, writer->sqesSize);
+    if(writer->cqRing != NULL && writer->cqRing != writer->sqRing)
+        munmap(writer->cqRing, writer->cqRingSize);
+    if(writer->sqRing != NULL) munmap(writer->sqRing, writer->sqRingSize);
+    close(writer->ringFd);
+    writer->ringFd = -1;
+}
+
+// Maps the submission and completion rings, as liburing would
+static int ringSetup(DiskWriter *writer)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    writer->sqRing = writer->cqRing = NULL;
+    writer->sqes = NULL;
+    writer->ringFd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if(writer->ringFd < 0) return -1;
+
+    writer->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    writer->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(writer->cqRingSize > writer->sqRingSize) writer->sqRingSize = writer->cqRingSize;
+        writer->cqRingSize = writer->sqRingSize;
+    }
+    writer->sqRing = mmap(NULL, writer->sqRingSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, writer->ringFd, IORING_OFF_SQ_RING);
+    if(writer->sqRing == MAP_FAILED){
+        writer->sqRing = NULL;
+        ringDestroy(writer);
+        return -1;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        writer->cqRing = writer->sqRing;
+    }
+    else{
+        writer->cqRing = mmap(NULL, writer->cqRingSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, writer->ringFd, IORING_OFF_CQ_RING);
+        if(writer->cqRing == MAP_FAILED){
+            writer->cqRing = NULL;
+            ringDestroy(writer);
+            return -1;
+        }
+    }
+    writer->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    writer->sqes = mmap(NULL, writer->sqesSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, writer->ringFd, IORING_OFF_SQES);
+    if(writer->sqes == MAP_FAILED){
+        writer->sqes = NULL;
+        ringDestroy(writer);
+        return -1;
+    }
+    writer->sqTail = (unsigned int *)(writer->sqRing + params.sq_off.tail);
+    writer->sqMask = (unsigned int *)(writer->sqRing + params.sq_off.ring_mask);
+    writer->sqArray = (unsigned int *)(writer->sqRing + params.sq_off.array);
+    writer->cqHead = (unsigned int *)(writer->cqRing + params.cq_off.head);
+    writer->cqTail = (unsigned int *)(writer->cqRing + params.cq_off.tail);
+    writer->cqMask = (unsigned int *)(writer->cqRing + params.cq_off.ring_mask);
+    writer->cqes = (struct io_uring_cqe *)(writer->cqRing + params.cq_off.cqes);
+    return 0;
+}
+
+#endif
+
+// Writes what is left of request after its first done bytes with pwritev(),
+// continuing short writes from where they stopped. request is left as it
+// was, so it can be written again.
+// Return "0" on success or "-1" on error.
+static int finishRequest(int fd, const WriterRequest *request, size_t done)
+{
+    struct iovec parts[WRITER_MAX_IOV];
+    memcpy(parts, request->iov, request->count * sizeof(struct iovec));
+    struct iovec *iov = parts;
+    int count = request->count;
+    off_t offset = request->offset + done;
+    // skip what was written
+    while(count > 0 && done >= iov->iov_len){
+        done -= iov->iov_len;
+        iov++;
+        count--;
+    }
+    if(count > 0){
+        iov->iov_base = (char *)iov->iov_base + done;
+        iov->iov_len -= done;
+    }
+    while(count > 0){
+        ssize_t written = pwritev(fd, iov, count, offset);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            perror("writerWrite()");
+            return -1;
+        }
+        offset += written;
+        while(count > 0 && (size_t)written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+#ifdef HAVE_IO_URING
+
+/**
+ * @brief Submits the queued requests as WRITEVs with one io_uring_enter()
+ * and reaps their completions, waiting until all of them arrived. Short
+ * writes are finished with pwritev(). If the ring fails, or the kernel has
+ * no WRITEV, it is released and every request written again with pwritev():
+ * rewriting data at its offset does no harm.
+ *
+ * @return "0" on success or "-1" on error
+ */
+static int ringFlush(DiskWriter *writer)
+{
+    int queued = writer->queued;
+    writer->queued = 0;
+    unsigned int tail = *writer->sqTail;
+    for(int i = 0; i < queued; i++){
+        WriterRequest *request = &writer->requests[i];
+        unsigned int index = (tail + i) & *writer->sqMask;
+        struct io_uring_sqe *sqe = &writer->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = writer->fd;
+        sqe->addr = (unsigned long)request->iov;
+        sqe->len = request->count;
+        sqe->off = request->offset;
+        sqe->user_data = i;
+        writer->sqArray[index] = index;
+    }
+    __atomic_store_n(writer->sqTail, tail + queued, __ATOMIC_RELEASE);
+
+    int submitted = 0, completed = 0, failed = FALSE, result = 0;
+    while(completed < queued && !failed){
+        int entered = syscall(__NR_io_uring_enter, writer->ringFd, queued - submitted,
+                              queued - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(entered < 0){
+            if(errno != EINTR) failed = TRUE;
+            continue;
+        }
+        submitted += entered;
+        unsigned int head = *writer->cqHead;
+        for(; head != __atomic_load_n(writer->cqTail, __ATOMIC_ACQUIRE); head++, completed++){
+            struct io_uring_cqe *cqe = &writer->cqes[head & *writer->cqMask];
+            WriterRequest *request = &writer->requests[cqe->user_data];
+            if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP){
+                failed = TRUE; // WRITEV not supported by this kernel
+            }
+            else if(cqe->res < 0){
+                errno = -cqe->res;
+                perror("writerWrite()");
+                result = -1;
+            }
+            else if((size_t)cqe->res < request->size &&
+                    finishRequest(writer->fd, request, cqe->res) < 0){
+                result = -1;
+            }
+        }
+        __atomic_store_n(writer->cqHead, head, __ATOMIC_RELEASE);
+    }
+    if(failed){
+        ringDestroy(writer);
+        result = 0;
+        for(int i = 0; i < queued; i++)
+            if(finishRequest(writer->fd, &writer->requests[i], 0) < 0) result = -1;
+    }
+    return result;
+}
+
+#endif
+
+void writerInit(DiskWriter *writer)
+{
+    writer->fd = -1;
+    writer->ringFd = -1;
+    writer->queued = 0;
+#ifdef HAVE_IO_URING
+    if(ringSetup(writer) < 0) writer->ringFd = -1;
+#endif
+}
+
+int writerOpen(DiskWriter *writer, const char *filename, off_t size, int keep)
+{
+    writer->fd = open(filename, O_WRONLY | O_CREAT | (keep ? 0 : O_TRUNC), 0644);
+    if(writer->fd < 0){
+        perror("writerOpen() - Error on open()");
+        return -1;
+    }
+    // reserve the blocks up front; not every file system supports it
+    if(size > 0 && fallocate(writer->fd, 0, 0, size) < 0 && errno != EOPNOTSUPP)
+        perror("writerOpen() - Error on fallocate()");
+    return 0;
+}
+
+int writerWrite(DiskWriter *writer, const struct iovec *iov, int count, off_t offset)
+{
+    while(count > 0){
+        int n = (count < WRITER_MAX_IOV) ? count : WRITER_MAX_IOV;
+        WriterRequest *request = &writer->requests[writer->queued];
+        memcpy(request->iov, iov, n * sizeof(struct iovec));
+        request->count = n;
+        request->offset = offset;
+        request->size = 0;
+        for(int i = 0; i < n; i++) request->size += iov[i].iov_len;
+        offset += request->size;
+        iov += n;
+        count -= n;
+#ifdef HAVE_IO_URING
+        if(writer->ringFd >= 0){
+            if(++writer->queued == WRITER_QUEUE && ringFlush(writer) < 0) return -1;
+            continue;
+        }
+#endif
+        if(finishRequest(writer->fd, request, 0) < 0) return -1;
+    }
+    return 0;
+}
+
+int writerFlush(DiskWriter *writer)
+{
+#ifdef HAVE_IO_URING
+    if(writer->ringFd >= 0 && writer->queued > 0) return ringFlush(writer);
+#endif
+    return 0;
+}
+
+int writerSync(DiskWriter *writer)
+{
+    writerFlush(writer);
+    return fdatasync(writer->fd);
+}
+
+void writerClose(DiskWriter *writer, off_t size)
+{
+    writerFlush(writer);
+    if(ftruncate(writer->fd, size) < 0) perror("writerClose() - Error on ftruncate()");
+    close(writer->fd);
+    writer->fd = -1;
+}
+
+void writerFree(DiskWriter *writer)
+{
+#ifdef HAVE_IO_URING
+    if(writer->ringFd >= 0) ringDestroy(writer);
+#endif
+}
@@ -0,0 +1,81 @@
+// Erasure code implementation
+
+#include "erasure_code.h"
+#include "reed_solomon.h"
+#include <string.h>
+
+// Weight of packet i in repair j: 1 / (x_j + y_i) with x_j = MAX_GROUP + j
+// and y_i = i, two disjoint sets, so every square submatrix is invertible
+static unsigned char coefficient(int k, int j, int i)
+{
+    if(k == 1) return 1;
+    return gfInverse((ERASURE_MAX_GROUP + j) ^ i);
+}
+
+void erasureAdd(int k, int j, int i, unsigned char *repair, const unsigned char *packet, int size)
+{
+    gfMulAdd(repair, packet, coefficient(k, j, i), size);
+}
+
+// Inverts the m x m matrix a into inverse by Gauss-Jordan elimination.
+// Return "-1" if it is singular.
+static int invert(unsigned char a[][ERASURE_MAX_REPAIR], unsigned char inverse[][ERASURE_MAX_REPAIR], int m)
+{
+    for(int r = 0; r < m; r++){
+        for(int c = 0; c < m; c++) inverse[r][c] = (r == c);
+    }
+    for(int c = 0; c < m; c++){
+        int pivot = c;
+        while(pivot < m && a[pivot][c] == 0) pivot++;
+        if(pivot == m) return -1;
+        for(int x = 0; x < m; x++){
+            unsigned char t = a[c][x]; a[c][x] = a[pivot][x]; a[pivot][x] = t;
+            t = inverse[c][x]; inverse[c][x] = inverse[pivot][x]; inverse[pivot][x] = t;
+        }
+        unsigned char scale = gfInverse(a[c][c]);
+        for(int x = 0; x < m; x++){
+            a[c][x] = gfMultiply(a[c][x], scale);
+            inverse[c][x] = gfMultiply(inverse[c][x], scale);
+        }
+        for(int r = 0; r < m; r++){
+            unsigned char factor = a[r][c];
+            if(r == c || factor == 0) continue;
+            for(int x = 0; x < m; x++){
+                a[r][x] ^= gfMultiply(factor, a[c][x]);
+                inverse[r][x] ^= gfMultiply(factor, inverse[c][x]);
+            }
+        }
+    }
+    return 0;
+}
+
+int erasureRebuild(int k, int n, unsigned char *packets[], const int present[],
+                   unsigned char *const repairs[], const int index[], int count, int size)
+{
+    int missing[ERASURE_MAX_REPAIR];
+    int m = 0;
+    for(int i = 0; i < n; i++){
+        if(present[i]) continue;
+        if(m == count || m == ERASURE_MAX_REPAIR) return -1;
+        missing[m++] = i;
+    }
+    if(m == 0) return 0;
+
+    // the first m repairs without the packets received leave m equations
+    // in the packets lost
+    unsigned char a[ERASURE_MAX_REPAIR][ERASURE_MAX_REPAIR];
+    unsigned char inverse[ERASURE_MAX_REPAIR][ERASURE_MAX_REPAIR];
+    for(int r = 0; r < m; r++){
+        for(int i = 0; i < n; i++){
+            if(present[i]) gfMulAdd(repairs[r], packets[i], coefficient(k, index[r], i), size);
+        }
+        for(int c = 0; c < m; c++) a[r][c] = coefficient(k, index[r], missing[c]);
+    }
+    if(invert(a, inverse, m) < 0) return -1;
+
+    for(int c = 0; c < m; c++){
+        memset(packets[missing[c]], 0, size);
+        for(int r = 0; r < m; r++) gfMulAdd(packets[missing[c]], repairs[r], inverse[c][r], size);
+    }
+    return 0;
+}
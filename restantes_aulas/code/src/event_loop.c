@@ -0,0 +1,91 @@
+// Event loop implementation
+
+#include "event_loop.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static int watch(EventLoop *loop, int op, int fd, unsigned int events)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(loop->epfd, op, fd, &ev);
+}
+
+int loopInit(EventLoop *loop, int fd)
+{
+    loop->fd = fd;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(loop->epfd < 0 || loop->timerfd < 0) return -1;
+
+    if(watch(loop, EPOLL_CTL_ADD, fd, EPOLLIN) < 0) return -1;
+    if(watch(loop, EPOLL_CTL_ADD, loop->timerfd, EPOLLIN) < 0) return -1;
+    return 0;
+}
+
+void loopClose(EventLoop *loop)
+{
+    close(loop->timerfd);
+    close(loop->epfd);
+}
+
+void loopSetTimer(EventLoop *loop, int ms)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (long)(ms % 1000) * 1000000;
+    timerfd_settime(loop->timerfd, 0, &spec, NULL);
+
+    // an expiration not yet seen by loopWait() belongs to the old timer
+    uint64_t expirations;
+    if(ms != 0) return;
+    while(read(loop->timerfd, &expirations, sizeof(expirations)) > 0);
+}
+
+int loopWait(EventLoop *loop, int waitMs)
+{
+    struct epoll_event events[2];
+    int n;
+    do{
+        n = epoll_wait(loop->epfd, events, 2, waitMs);
+    }while(n < 0 && errno == EINTR);
+
+    int mask = 0;
+    for(int i = 0; i < n; i++){
+        if(events[i].data.fd == loop->timerfd){
+            uint64_t expirations;
+            if(read(loop->timerfd, &expirations, sizeof(expirations)) > 0)
+                mask |= EVENT_TIMER;
+        }
+        else if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+            mask |= EVENT_READABLE;
+        }
+    }
+    return mask;
+}
+
+int loopWrite(EventLoop *loop, const unsigned char *buf, int size)
+{
+    int written = 0;
+    while(written < size){
+        int n = write(loop->fd, buf + written, size - written);
+        if(n > 0){
+            written += n;
+            continue;
+        }
+        if(n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+
+        // output buffer full: sleep until the port accepts more
+        struct pollfd pfd = {loop->fd, POLLOUT, 0};
+        poll(&pfd, 1, -1);
+    }
+    return written;
+}
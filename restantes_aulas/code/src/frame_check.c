@@ -0,0 +1,172 @@
+// Frame check sequence implementation
+
+#include "frame_check.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define FALSE 0
+#define TRUE 1
+
+// Reflected polynomials: CRC-16-CCITT as used by HDLC/X.25, and Castagnoli
+#define CRC16_POLY 0x8408
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc16Tables[8][256];
+static uint32_t crc32cTables[8][256];
+static int crc32cInstruction; // the CPU has SSE4.2, set with the tables
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+// T[0] is the classic byte-at-a-time table, T[k][n] is the CRC of byte n
+// followed by k zero bytes, so 8 bytes are folded with 8 lookups.
+static void buildTables(uint32_t tables[8][256], uint32_t poly)
+{
+    for(uint32_t n = 0; n < 256; n++){
+        uint32_t crc = n;
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+        tables[0][n] = crc;
+    }
+    for(uint32_t n = 0; n < 256; n++){
+        for(int k = 1; k < 8; k++)
+            tables[k][n] = (tables[k-1][n] >> 8) ^ tables[0][tables[k-1][n] & 0xFF];
+    }
+}
+
+static void buildAllTables()
+{
+    buildTables(crc16Tables, CRC16_POLY);
+    buildTables(crc32cTables, CRC32C_POLY);
+#ifdef HAVE_X86_SIMD
+    crc32cInstruction = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+// links on other threads may check frames at the same time
+static void initTables()
+{
+    pthread_once(&tablesOnce, buildAllTables);
+}
+
+static inline uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Slicing-by-8 over a reflected CRC of up to 32 bits
+static uint32_t crcSlicing8(uint32_t tables[8][256], uint32_t crc, const unsigned char *data, int size)
+{
+    int i = 0;
+    for(; i + 8 <= size; i += 8){
+        uint32_t lo = crc ^ load32(data + i);
+        uint32_t hi = load32(data + i + 4);
+        crc = tables[7][lo & 0xFF] ^ tables[6][(lo >> 8) & 0xFF] ^
+              tables[5][(lo >> 16) & 0xFF] ^ tables[4][lo >> 24] ^
+              tables[3][hi & 0xFF] ^ tables[2][(hi >> 8) & 0xFF] ^
+              tables[1][(hi >> 16) & 0xFF] ^ tables[0][hi >> 24];
+    }
+    for(; i < size; i++)
+        crc = (crc >> 8) ^ tables[0][(crc ^ data[i]) & 0xFF];
+    return crc;
+}
+
+unsigned int crc16Table(const unsigned char *data, int size)
+{
+    initTables();
+    return crcSlicing8(crc16Tables, 0xFFFF, data, size) ^ 0xFFFF;
+}
+
+unsigned int crc32cTable(const unsigned char *data, int size)
+{
+    initTables();
+    return crcSlicing8(crc32cTables, 0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char *data, int size)
+{
+    int i = 0;
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for(; i + 8 <= size; i += 8){
+        uint64_t word = (uint64_t)load32(data + i) | (uint64_t)load32(data + i + 4) << 32;
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for(; i < size; i++) crc = _mm_crc32_u8(crc, data[i]);
+    return crc;
+}
+
+#endif
+
+// Both CRCs start from all ones and are inverted at the end, so a finished
+// value is resumed by inverting it back
+static unsigned int crc32c(unsigned int fcs, const unsigned char *data, int size)
+{
+    initTables();
+#ifdef HAVE_X86_SIMD
+    if(crc32cInstruction) return crc32cHardware(fcs ^ 0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+#endif
+    return crcSlicing8(crc32cTables, fcs ^ 0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+}
+
+int fcsSize(FcsType type)
+{
+    switch(type){
+        case FcsCrc16: return 2;
+        case FcsCrc32c: return 4;
+        default: return 1;
+    }
+}
+
+unsigned int fcsUpdate(FcsType type, unsigned int fcs, const unsigned char *data, int size)
+{
+    switch(type){
+        case FcsCrc16:
+            initTables();
+            return crcSlicing8(crc16Tables, fcs ^ 0xFFFF, data, size) ^ 0xFFFF;
+        case FcsCrc32c:
+            return crc32c(fcs, data, size);
+        default:{
+            unsigned char BCC2 = fcs;
+            for(int i = 0; i < size; i++) BCC2 ^= data[i];
+            return BCC2;
+        }
+    }
+}
+
+unsigned int fcsCompute(FcsType type, const unsigned char *data, int size)
+{
+    return fcsUpdate(type, 0, data, size);
+}
+
+int fcsStore(FcsType type, unsigned int fcs, unsigned char *out)
+{
+    int n = fcsSize(type);
+    for(int i = 0; i < n; i++) out[i] = (fcs >> (8 * i)) & 0xFF;
+    return n;
+}
+
+int fcsAppend(FcsType type, const unsigned char *data, int size, unsigned char *out)
+{
+    return fcsStore(type, fcsCompute(type, data, size), out);
+}
+
+int fcsCheck(FcsType type, const unsigned char *frame, int size)
+{
+    int n = fcsSize(type);
+    if(size < n) return FALSE;
+
+    unsigned int fcs = fcsCompute(type, frame, size - n);
+    for(int i = 0; i < n; i++){
+        if(frame[size - n + i] != ((fcs >> (8 * i)) & 0xFF)) return FALSE;
+    }
+    return TRUE;
+}
@@ -0,0 +1,178 @@
+// Frame decoder implementation
+
+#include "frame_decoder.h"
+#include <unistd.h>
+
+#define FALSE 0
+#define TRUE 1
+#define FLAG 0x7e
+#define ESC 0x7D
+#define A 0x03
+#define BCC(n,m) (n ^ m)
+
+// Input classes of the state machine. BCC1 is not a property of the byte
+// alone: it is only produced in C_RCV, when the byte matches A ^ C.
+typedef enum {IN_FLAG, IN_ESC, IN_A, IN_OTHER, IN_BCC1, N_INPUTS} input;
+
+typedef enum
+{
+    NONE,
+    SAVE_C,       // byte is the control field
+    BEGIN,        // header checked, data field starts
+    BEGIN_STORE,  // data field starts with this byte
+    STORE,        // byte belongs to the data field
+    EMIT_HEADER,  // closing flag of a frame without data field
+    EMIT_DATA,    // closing flag of a frame with data field
+} action;
+
+typedef struct
+{
+    stateMachine next;
+    action action;
+} transition;
+
+static const transition transitions[N_STATES][N_INPUTS] = {
+    //               IN_FLAG                  IN_ESC                 IN_A                      IN_OTHER                  IN_BCC1
+    [START]      = {{FLAG_RCV, NONE},        {START, NONE},         {START, NONE},            {START, NONE},            {START, NONE}},
+    [FLAG_RCV]   = {{FLAG_RCV, NONE},        {START, NONE},         {A_RCV, NONE},            {START, NONE},            {START, NONE}},
+    [A_RCV]      = {{FLAG_RCV, NONE},        {C_RCV, SAVE_C},       {C_RCV, SAVE_C},          {C_RCV, SAVE_C},          {C_RCV, SAVE_C}},
+    [C_RCV]      = {{FLAG_RCV, NONE},        {START, NONE},         {START, NONE},            {START, NONE},            {BCC_NORMAL, NONE}},
+    [BCC_NORMAL] = {{FLAG_RCV, EMIT_HEADER}, {ESC_RCV, BEGIN},      {BCC_DATA, BEGIN_STORE},  {BCC_DATA, BEGIN_STORE},  {BCC_DATA, BEGIN_STORE}},
+    [BCC_DATA]   = {{FLAG_RCV, EMIT_DATA},   {ESC_RCV, NONE},       {BCC_DATA, STORE},        {BCC_DATA, STORE},        {BCC_DATA, STORE}},
+    [ESC_RCV]    = {{BCC_DATA, STORE},       {BCC_DATA, STORE},     {BCC_DATA, STORE},        {BCC_DATA, STORE},        {BCC_DATA, STORE}},
+};
+
+static input inputOf(const FrameDecoder *decoder, unsigned char byte)
+{
+    switch(byte){
+        case FLAG: return IN_FLAG;
+        case ESC: return IN_ESC;
+        default: break;
+    }
+    if(decoder->state == C_RCV && byte == BCC(A, decoder->control)) return IN_BCC1;
+    return (byte == A) ? IN_A : IN_OTHER;
+}
+
+static void emit(FrameDecoder *decoder, Frame *frame, int hasData)
+{
+    frame->type = decoder->types[decoder->control];
+    frame->seq = decoder->control >> decoder->seqShift;
+    frame->control = decoder->control;
+    frame->data = decoder->data;
+    frame->hasData = hasData;
+    frame->size = 0;
+    frame->corrected = 0;
+    if(!hasData) return;
+
+    int checkSize = fcsSize(decoder->fcs);
+    int size = decoder->size;
+    int valid;
+    if(decoder->fecParity > 0 && frame->type == FrameInfo){
+        // the running BCC2 is of the bytes before correction
+        size = rsDecode(decoder->fecParity, decoder->data, size, &frame->corrected);
+        valid = size >= 0 && fcsCheck(decoder->fcs, decoder->data, size);
+    }
+    else{
+        valid = (decoder->fcs == FcsBcc)
+            ? decoder->BCC2 == 0 // the XOR of data and BCC2 is zero when they match
+            : fcsCheck(decoder->fcs, decoder->data, size);
+    }
+    frame->size = (valid && size >= checkSize) ? size - checkSize : -1;
+}
+
+void decoderInit(FrameDecoder *decoder)
+{
+    decoder->head = 0;
+    decoder->tail = 0;
+    decoder->state = START;
+    decoder->fcs = FcsBcc;
+    decoder->fecParity = 0;
+    decoderSetSequenceShift(decoder, 7);
+}
+
+void decoderSetFcs(FrameDecoder *decoder, FcsType fcs)
+{
+    decoder->fcs = fcs;
+}
+
+void decoderSetFec(FrameDecoder *decoder, int parity)
+{
+    decoder->fecParity = parity;
+}
+
+void decoderSetSequenceShift(FrameDecoder *decoder, int shift)
+{
+    unsigned int typeMask = (1 << shift) - 1;
+    decoder->seqShift = shift;
+
+    for(unsigned int c = 0; c < 256; c++){
+        switch(c & typeMask){
+            case CTRL_I: decoder->types[c] = FrameInfo; break;
+            case CTRL_RR: decoder->types[c] = FrameRr; break;
+            case CTRL_REJ: decoder->types[c] = FrameRej; break;
+            case CTRL_SACK: decoder->types[c] = FrameSack; break;
+            default: decoder->types[c] = FrameUnknown;
+        }
+    }
+    decoder->types[CTRL_SET] = FrameSet;
+    decoder->types[CTRL_UA] = FrameUa;
+    decoder->types[CTRL_DISC] = FrameDisc;
+}
+
+int decoderFill(FrameDecoder *decoder, int fd)
+{
+    unsigned int offset = decoder->head % DECODER_RING_SIZE;
+    unsigned int space = DECODER_RING_SIZE - (decoder->head - decoder->tail);
+
+    // only the contiguous part, the rest is filled on the next call
+    if(space > DECODER_RING_SIZE - offset) space = DECODER_RING_SIZE - offset;
+    if(space == 0) return 0;
+
+    int bytes = read(fd, decoder->ring + offset, space);
+    if(bytes > 0) decoder->head += bytes;
+    return bytes;
+}
+
+int decoderNext(FrameDecoder *decoder, Frame *frame)
+{
+    while(decoder->tail != decoder->head){
+        unsigned char byte = decoder->ring[decoder->tail++ % DECODER_RING_SIZE];
+        transition t = transitions[decoder->state][inputOf(decoder, byte)];
+        decoder->state = t.next;
+
+        switch(t.action){
+            case NONE:
+                break;
+
+            case SAVE_C:
+                decoder->control = byte;
+                break;
+
+            case BEGIN:
+            case BEGIN_STORE:
+                decoder->size = 0;
+                decoder->BCC2 = 0;
+                if(t.action == BEGIN) break;
+                // the byte is data
+                __attribute__((fallthrough));
+            case STORE:
+                if(decoder->size == DECODER_MAX_DATA){
+                    decoder->state = START;
+                    break;
+                }
+                decoder->data[decoder->size++] = byte;
+                decoder->BCC2 = BCC(decoder->BCC2, byte);
+                break;
+
+            case EMIT_HEADER:
+                emit(decoder, frame, FALSE);
+                return TRUE;
+
+            case EMIT_DATA:
+                if(decoder->size == 0) break;
+                emit(decoder, frame, TRUE);
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
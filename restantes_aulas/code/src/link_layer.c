@@ -1,6 +1,12 @@
 // Link layer protocol implementation
 
-#include "link_layer.h"
+#include "link_async.h"
+#include "byte_stuffing.h"
+#include "frame_decoder.h"
+#include "frame_check.h"
+#include "reed_solomon.h"
+#include "event_loop.h"
+#include "rto_estimator.h"
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,9 +15,7 @@
 #include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
-#include <signal.h>
 
-typedef enum {START, FLAG_RCV, A_RCV, C_RCV, BCC_NORMAL, BCC_DATA, DONE} stateMachine;
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
 #define FALSE 0
@@ -20,337 +24,965 @@ typedef enum {START, FLAG_RCV, A_RCV, C_RCV, BCC_NORMAL, BCC_DATA, DONE} stateMa
 #define UA_SIZE 5
 #define FLAG 0x7e
 #define A 0x03
-#define C 0x03
-#define C_RECEIVER 0x07
+#define C CTRL_SET
+#define C_RECEIVER CTRL_UA
 #define BCC(n,m) (n ^ m)
 #define F 0x7e
 #define ESC 0x7D
 #define TRANSMITER 1
 #define RECEIVER 0
-#define ACK(n) ((n)<<7 | 0x05)
-#define NACK(n) ((n)<<7 | 0x01)
-#define REPEATED_MESSAGE 2
+#define ACK(n) ((n)<<link->seqShift | CTRL_RR)
+#define NACK(n) ((n)<<link->seqShift | CTRL_REJ)
+#define C_I(n) ((n)<<link->seqShift | CTRL_I)
+#define SACK(n) ((n)<<link->seqShift | CTRL_SACK)
+#define C_DISC CTRL_DISC
+#define NO_PACKET (-2) // a frame was taken but no packet is ready
+#define SHIFT_STOP_AND_WAIT 7
+#define SHIFT_WINDOWED 4
+// Parameters carried in the data field of SET/UA (type, length, value)
+#define PARAM_ARQ 0x01
+#define PARAM_WINDOW 0x02
+#define PARAM_FCS 0x03
+#define PARAM_MAX_PAYLOAD 0x04
+#define PARAM_TRANSFER_ID 0x05
+#define PARAM_RESUME_OFFSET 0x06
+#define PARAM_FEC 0x07
+#define MAX_PARAMS_SIZE 64
+#define MAX_FIELD_SIZE RS_ENCODED_BOUND(MAX_LINK_PAYLOAD + MAX_FCS_SIZE)
+#define MAX_FRAME_SIZE (2 * MAX_FIELD_SIZE + 5)
+// SACK frame: one bitmap byte and the check value, both possibly stuffed
+#define SACK_FRAME_SIZE (2 * (1 + MAX_FCS_SIZE) + 5)
+
+// Ring of requests or completions of the asynchronous interface
+typedef struct
+{
+    LinkCompletion items[ASYNC_QUEUE];
+    unsigned int head, tail; // next taken, next added
+} AsyncQueue;
 
-stateMachine state;
-int failed = 0;
-int alarm_enabled;
-int alarm_count = 0;
-int sn = 0;
-int fd;
+// State of one connection: everything llopen_r() sets up, so links on
+// different ports share nothing
+struct LinkConnection
+{
+    int fd;
+    struct termios oldtio;
+    LinkLayerRole role;
+    EventLoop loop;
+    FrameDecoder decoder;
+    LinkStatistics stats;
+    double openedAt, closedAt; // ms, closedAt is 0 while the link is open
+    int failed; // set when the retransmission timer expires
+    int sn;
+    int seqShift;
+    RtoEstimator rto; // retransmission timeout, starts at LinkLayer.timeout
+    int maxRetransmissions;
+    LinkOptions options;
+    FcsType fcs;   // check value of the frames sent, switched after SET/UA
+    int fecParity; // Reed-Solomon parity of the I-frames sent, same
+
+    // Go-Back-N: frames sent and not yet acknowledged, indexed by sequence
+    // number. Frames are kept unstuffed, as the segments of their data field:
+    // txParts (a copy of the packet header and the caller's data for
+    // llwritepacket_r(), txCopy for llwritev_r() in the windowed modes) or,
+    // while a stop-and-wait llwritev_r() runs, the caller's own segments.
+    // Each transmission is stuffed again into txWire.
+    unsigned char txHeaders[SEQ_MODULUS][MAX_PACKET_HEADER];
+    struct iovec txParts[SEQ_MODULUS][2];
+    const struct iovec *txSegments[SEQ_MODULUS];
+    int txSegmentCounts[SEQ_MODULUS];
+    unsigned char txCopy[SEQ_MODULUS][MAX_LINK_PAYLOAD];
+    unsigned char txWire[MAX_FRAME_SIZE];
+    // I-frame data field before and after Reed-Solomon encoding
+    unsigned char txField[MAX_LINK_PAYLOAD + MAX_FCS_SIZE];
+    unsigned char txEncoded[MAX_FIELD_SIZE];
+    int txBase;     // oldest unacknowledged sequence number (sn is the next one)
+    int txAttempts; // consecutive timeouts without progress
+    double txSentAt[SEQ_MODULUS]; // first transmission (ms), for RTT samples
+    int txRetransmitted[SEQ_MODULUS];
+    int rxRejSent;
+    int rxLastSeq; // unacknowledged mode: N(S) of the last frame delivered
+    int rxDiscReceived;
+    // UA sent by the receiver, repeated if the SET is retransmitted
+    unsigned char uaFrame[2 * (MAX_PARAMS_SIZE + 1) + 5];
+    int uaSize;
+    // Selective Repeat: frames selectively acknowledged/already resent for
+    // a gap, and the receiver's reorder buffer (size -1 marks an empty slot)
+    int txAcked[SEQ_MODULUS];
+    int txResent[SEQ_MODULUS];
+    unsigned char rxFrames[SEQ_MODULUS][MAX_LINK_PAYLOAD];
+    int rxSizes[SEQ_MODULUS];
+
+    // Asynchronous interface (link_async.h): writes not yet sent (result
+    // holds their size), buffers for the next packets and completions not
+    // yet taken, the requests behind the I-frames in flight
+    AsyncQueue asyncWrites;
+    AsyncQueue asyncReads;
+    AsyncQueue asyncDone;
+    int asyncRequests;  // submitted and not yet taken
+    int asyncCompleted; // by the current llprogress_r()
+    int asyncFailed;    // the link gave up, nothing more is accepted
+    int asyncBusy;      // stop-and-wait: a submitted frame is in flight
+    LinkCompletion txRequests[SEQ_MODULUS];
+    int txAsync[SEQ_MODULUS]; // the frame came from llsubmitwrite_r()
+    LinkCallback callback;
+    void *callbackArg;
+};
+
+// Writes a frame to the port, counting it and the bytes stuffing added to
+// it (every ESC in a stuffed frame was added in front of a data byte)
+int writeFrame(LinkConnection *link, const unsigned char *frame, int size)
+{
+    link->stats.framesSent++;
+    link->stats.bytesSent += size;
+    if((frame[2] & 0x0F) == CTRL_I){
+        link->stats.infoFramesSent++;
+        link->stats.infoBytesSent += size;
+    }
+    for(const unsigned char *p = frame; (p = memchr(p, ESC, frame + size - p)) != NULL; p++)
+        link->stats.stuffingBytes++;
+    return loopWrite(&link->loop, frame, size);
+}
 
-volatile int STOP = FALSE;
-struct termios oldtio;
+// Milliseconds bytes take on the line at the port's bit rate, 10 bits each
+// with the start and stop bits
+double lineTimeMs(const LinkConnection *link, int bytes)
+{
+    if(link->stats.baudRate <= 0) return 0;
+    return bytes * 10 * 1000.0 / link->stats.baudRate;
+}
 
-void alarmHandler(int signal)
-{   
-    printf("<Receiver didn't Answer>\n");
-    alarm_enabled = FALSE;
-    alarm_count++;
-    failed = 1;
+// Line time of I-frame seq and of its RR, stuffing left out. The estimator
+// times the rest of the round trip, the same for frames of any size:
+// otherwise the small START packet sets a timeout that full data frames
+// exceed on a slow line.
+double frameLineMs(LinkConnection *link, int seq)
+{
+    int bytes = 2 * 5 + MAX_FCS_SIZE;
+    for(int i = 0; i < link->txSegmentCounts[seq]; i++)
+        bytes += link->txSegments[seq][i].iov_len;
+    return lineTimeMs(link, bytes);
 }
 
-void determineState(stateMachine *state, char byte, int user)
+// Timeout to arm while I-frame seq is the oldest waiting for an answer
+int frameTimeout(LinkConnection *link, int seq)
 {
-    unsigned char A_FLAG = 0x03;
-    unsigned char C_FLAG = (user)? 0x07 : 0x03;
-    
-    
-    switch(*state){
-        case START:
-            if( byte == FLAG) *state = FLAG_RCV;
-            break;
+    return rtoCurrent(&link->rto) + (int)frameLineMs(link, seq);
+}
 
-        case FLAG_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == A_FLAG) *state = A_RCV;
-            else *state = START;
-            break;
+// RR for I-frame seq, sent once (Karn): a round-trip sample
+void sampleRoundTrip(LinkConnection *link, int seq)
+{
+    double rtt = rtoNow() - link->txSentAt[seq] - frameLineMs(link, seq);
+    rtoSample(&link->rto, rtt > 0 ? rtt : 0);
+}
 
-        case A_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == C_FLAG) *state = C_RCV;
-            else *state = START;
-            break;
+/**
+ * @brief Builds FLAG A C BCC1 [data BCC2] FLAG, the data field being the
+ * count segments one after the other: each is checked and stuffed where it
+ * is, straight into frame, which must hold MAX_FRAME_SIZE bytes
+ *
+ * @return size of the frame
+ */
+int buildFrameParts(LinkConnection *link, unsigned char *frame, unsigned char control,
+                    const struct iovec *segments, int count)
+{
+    int n = 0;
+    frame[n++] = FLAG;
+    frame[n++] = A;
+    frame[n++] = control;
+    frame[n++] = BCC(A, control);
+    if(link->fcs == FcsBcc && count == 1){
+        n += stuffData(frame + n, segments[0].iov_base, segments[0].iov_len);
+    }
+    else{
+        unsigned char check[MAX_FCS_SIZE], BCC2;
+        unsigned int value = 0;
+        for(int i = 0; i < count; i++){
+            value = fcsUpdate(link->fcs, value, segments[i].iov_base, segments[i].iov_len);
+            n += stuffBytes(frame + n, segments[i].iov_base, segments[i].iov_len, &BCC2);
+        }
+        int checkSize = fcsStore(link->fcs, value, check);
+        n += stuffBytes(frame + n, check, checkSize, &BCC2);
+    }
+    frame[n++] = FLAG;
+    return n;
+}
 
-        case C_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == BCC(A_FLAG, C_FLAG)) *state = BCC_NORMAL;
-            else *state = START;
-            break;
+int buildFrame(LinkConnection *link, unsigned char *frame, unsigned char control, const unsigned char *data, int size)
+{
+    struct iovec segment = {(void *)data, size};
+    return buildFrameParts(link, frame, control, &segment, 1);
+}
 
-        case BCC_NORMAL:
-            if(byte == FLAG)  *state = DONE;
-            else *state = START;
-            break;
+/**
+ * @brief Builds I-frame seq from its segments. With FEC the data field
+ * (segments and check value) is gathered in txField and Reed-Solomon encoded
+ * before stuffing, so the receiver can correct it before checking it.
+ *
+ * @return size of the frame
+ */
+int buildInformation(LinkConnection *link, unsigned char *frame, int seq)
+{
+    const struct iovec *segments = link->txSegments[seq];
+    int count = link->txSegmentCounts[seq];
+    if(link->fecParity == 0)
+        return buildFrameParts(link, frame, C_I(seq), segments, count);
+
+    int size = 0;
+    for(int i = 0; i < count; i++){
+        memcpy(link->txField + size, segments[i].iov_base, segments[i].iov_len);
+        size += segments[i].iov_len;
+    }
+    size += fcsAppend(link->fcs, link->txField, size, link->txField + size);
+    int encoded = rsEncode(link->fecParity, link->txField, size, link->txEncoded);
+
+    unsigned char BCC2;
+    int n = 0;
+    frame[n++] = FLAG;
+    frame[n++] = A;
+    frame[n++] = C_I(seq);
+    frame[n++] = BCC(A, C_I(seq));
+    n += stuffBytes(frame + n, link->txEncoded, encoded, &BCC2);
+    frame[n++] = FLAG;
+    return n;
+}
+
+// Stuffs I-frame seq from its segments into txWire and sends it
+int sendInformation(LinkConnection *link, int seq)
+{
+    return writeFrame(link, link->txWire, buildInformation(link, link->txWire, seq));
+}
+
+// Waits for the port or the retransmission timer (failed is set when it
+// expires), or only checks for them if waitMs is 0.
+// Returns FALSE if nothing happened.
+int waitLine(LinkConnection *link, int waitMs)
+{
+    int events = loopWait(&link->loop, waitMs);
+    if(events & EVENT_TIMER){
+        link->failed = TRUE;
+        link->stats.timeouts++;
+    }
+    if(events & EVENT_READABLE){
+        int bytes = decoderFill(&link->decoder, link->fd);
+        if(bytes > 0) link->stats.bytesReceived += bytes;
+    }
+    return events != 0;
+}
+
+// decoderNext(), counting the frames decoded
+int nextFrame(LinkConnection *link, Frame *frame)
+{
+    if(!decoderNext(&link->decoder, frame)) return FALSE;
+    link->stats.framesReceived++;
+    if(frame->hasData && frame->size < 0) link->stats.badFrames++;
+    if(frame->corrected > 0 && frame->size >= 0){
+        link->stats.fecFrames++;
+        link->stats.fecBytes += frame->corrected;
+    }
+    return TRUE;
+}
+
+// Next frame from the line, or FALSE if the retransmission timer expired
+// before a complete frame arrived.
+int readFrame(LinkConnection *link, Frame *frame)
+{
+    while(!nextFrame(link, frame)){
+        waitLine(link, -1);
+        if(link->failed) return nextFrame(link, frame);
+    }
+    return TRUE;
+}
+
+int sendSupervision(LinkConnection *link, unsigned char control)
+{
+    unsigned char buf[] = {FLAG, A, control, BCC(A, control), F};
+    return writeFrame(link, buf, 5);
+}
+
+/**
+ * @brief Answers the unnumbered frames a receiver may get while waiting for
+ * I-frames instead of dropping them: a repeated SET means our UA was lost.
+ *
+ * @return -1 if the transmitter disconnected
+ */
+int answerControlFrame(LinkConnection *link, const Frame *frame)
+{
+    switch(frame->type){
+        case FrameSet:
+            printf("Repeated SET, sending UA again...\n");
+            writeFrame(link, link->uaFrame, link->uaSize);
+            return 0;
+
+        case FrameDisc:
+            link->rxDiscReceived = TRUE;
+            return -1;
+
+        default:
+            return 0;
+    }
+}
+
+LinkOptions llgetoptions_r(LinkConnection *link)
+{
+    return link->options;
+}
+
+// Appends a parameter with an 8-byte big-endian value
+int encodeLong(unsigned char *buf, int n, unsigned char type, unsigned long long value)
+{
+    buf[n++] = type;
+    buf[n++] = 8;
+    for(int i = 7; i >= 0; i--) buf[n++] = value >> (8 * i);
+    return n;
+}
+
+int encodeParams(unsigned char *buf, LinkOptions o)
+{
+    buf[0] = PARAM_ARQ;
+    buf[1] = 1;
+    buf[2] = o.arq;
+    buf[3] = PARAM_WINDOW;
+    buf[4] = 1;
+    buf[5] = o.window;
+    buf[6] = PARAM_FCS;
+    buf[7] = 1;
+    buf[8] = o.fcs;
+    buf[9] = PARAM_MAX_PAYLOAD;
+    buf[10] = 4;
+    buf[11] = o.maxPayload >> 24;
+    buf[12] = o.maxPayload >> 16;
+    buf[13] = o.maxPayload >> 8;
+    buf[14] = o.maxPayload;
+    buf[15] = PARAM_FEC;
+    buf[16] = 1;
+    buf[17] = o.fecParity;
+    int n = 18;
+    if(o.transferId != 0){
+        n = encodeLong(buf, n, PARAM_TRANSFER_ID, o.transferId);
+        n = encodeLong(buf, n, PARAM_RESUME_OFFSET, o.resumeOffset);
+    }
+    return n;
+}
+
+void decodeParams(const unsigned char *buf, int size, LinkOptions *o)
+{
+    for(int i = 0; i + 1 < size && i + 2 + buf[i+1] <= size; i += 2 + buf[i+1]){
+        // values are big-endian, one byte long except the payload size,
+        // transfer ID and resume offset
+        unsigned long long value = 0;
+        for(int j = 0; j < buf[i+1] && j < 8; j++) value = value << 8 | buf[i+2+j];
+        switch(buf[i]){
+            case PARAM_ARQ: o->arq = buf[i+2]; break;
+            case PARAM_WINDOW: o->window = buf[i+2]; break;
+            case PARAM_FCS: o->fcs = (buf[i+2] <= FcsCrc32c) ? buf[i+2] : FcsBcc; break;
+            case PARAM_MAX_PAYLOAD: o->maxPayload = value; break;
+            case PARAM_TRANSFER_ID: o->transferId = value; break;
+            case PARAM_RESUME_OFFSET: o->resumeOffset = value; break;
+            case PARAM_FEC: o->fecParity = buf[i+2]; break;
+            default: break; // unknown parameters are ignored
+        }
     }
+}
+
+// Window proposed in the SET when the options leave it at 0
+int defaultWindow(ArqMode arq)
+{
+    if(arq == ArqGoBackN) return 7;
+    if(arq == ArqSelectiveRepeat) return MAX_SR_WINDOW;
+    return 1;
+}
 
+// Switches the link to the options agreed in the SET/UA exchange
+void applyOptions(LinkConnection *link, LinkOptions agreed)
+{
+    if(agreed.arq > ArqNone) agreed.arq = ArqStopAndWait;
+    if(agreed.window < 1) agreed.window = 1;
+    if(agreed.window > MAX_WINDOW) agreed.window = MAX_WINDOW;
+    if(agreed.arq == ArqSelectiveRepeat && agreed.window > MAX_SR_WINDOW)
+        agreed.window = MAX_SR_WINDOW;
+    if(agreed.arq == ArqStopAndWait || agreed.arq == ArqNone) agreed.window = 1;
+    if(agreed.maxPayload < MAX_PAYLOAD_SIZE) agreed.maxPayload = MAX_PAYLOAD_SIZE;
+    if(agreed.maxPayload > MAX_LINK_PAYLOAD) agreed.maxPayload = MAX_LINK_PAYLOAD;
+    if(agreed.fecParity < 0) agreed.fecParity = 0;
+    if(agreed.fecParity > RS_MAX_PARITY) agreed.fecParity = RS_MAX_PARITY;
+    link->options = agreed;
+    link->seqShift = (agreed.arq == ArqStopAndWait) ? SHIFT_STOP_AND_WAIT : SHIFT_WINDOWED;
+    decoderSetSequenceShift(&link->decoder, link->seqShift);
+    link->sn = 0;
+    link->txBase = 0;
+    link->txAttempts = 0;
+    link->rxRejSent = FALSE;
+    link->rxLastSeq = -1;
+    link->rxDiscReceived = FALSE;
+    for(int i = 0; i < SEQ_MODULUS; i++){
+        link->txAcked[i] = FALSE;
+        link->txResent[i] = FALSE;
+        link->rxSizes[i] = -1;
+    }
 }
 
+// termios speed of a baud rate in bits per second, which is what main.c
+// passes. ORing the number itself into c_cflag sets unrelated flags (B0 and
+// HUPCL for 9600), and a port left that way by a killed process refuses the
+// next tcsetattr(). Bxxx constants are passed through.
+tcflag_t baudFlag(int baudRate)
+{
+    switch(baudRate){
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        default: return baudRate & CBAUD;
+    }
+}
 
 ////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////
-int llopen(LinkLayer connectionParameters)
+// Gives the port back as llopen_r() found it, for a failed open
+LinkConnection *openFailed(LinkConnection *link, const char *what, int restore)
+{
+    if(what != NULL) perror(what);
+    if(restore) tcsetattr(link->fd, TCSANOW, &link->oldtio);
+    close(link->fd);
+    free(link);
+    return NULL;
+}
+
+LinkConnection *llopen_r(LinkLayer connectionParameters, LinkOptions options)
 {
-   struct sigaction action;
-    sigemptyset(&action.sa_mask);
-    action.sa_flags = 0;
-    action.sa_handler = alarmHandler;
-    sigaction(SIGALRM, &action, NULL);
-    //(void)siginterrupt(SIGALRM,1);
     // Open serial port device for reading and writing, and not as controlling tty
     // because we don't want to get killed if linenoise sends CTRL-C.
 
     struct termios newtio;
+    int stop = FALSE;
+
+    // the frame buffers make it too large for a stack
+    LinkConnection *link = calloc(1, sizeof(LinkConnection));
+    if (link == NULL) return NULL;
+    link->options = options;
+    link->role = connectionParameters.role;
 
-    fd = open(connectionParameters.serialPort, O_RDWR | O_NOCTTY);
+    // Non-blocking: reads and writes are driven by the event loop.
+    link->fd = open(connectionParameters.serialPort, O_RDWR | O_NOCTTY | O_NONBLOCK);
 
-    if (fd < 0)
+    if (link->fd < 0)
     {
         perror(connectionParameters.serialPort);
-        exit(-1);
+        free(link);
+        return NULL;
     }
 
     // Save current port settings
-    if (tcgetattr(fd, &oldtio) == -1)
-    {
-        perror("tcgetattr");
-        exit(-1);
-    }
+    if (tcgetattr(link->fd, &link->oldtio) == -1)
+        return openFailed(link, "tcgetattr", FALSE);
 
     // Clear struct for new port settings
     memset(&newtio, 0, sizeof(newtio));
 
-    newtio.c_cflag = connectionParameters.baudRate | CS8 | CLOCAL | CREAD;
+    newtio.c_cflag = baudFlag(connectionParameters.baudRate) | CS8 | CLOCAL | CREAD;
     newtio.c_iflag = IGNPAR;
     newtio.c_oflag = 0;
 
     // Set input mode (non-canonical, no echo,...)
     newtio.c_lflag = 0;
-    newtio.c_cc[VTIME] = 1; // Inter-character timer unused
-    newtio.c_cc[VMIN] = 0;  // Blocking read until 5 chars received
-    tcflush(fd, TCIOFLUSH);
+    newtio.c_cc[VTIME] = 0; // Inter-character timer unused
+    newtio.c_cc[VMIN] = 0;  // Reads return what is available, epoll waits
+    tcflush(link->fd, TCIOFLUSH);
 
     // Set new port settings
-    if (tcsetattr(fd, TCSANOW, &newtio) == -1)
-    {
-        perror("tcsetattr");
-        exit(-1);
-    }
+    if (tcsetattr(link->fd, TCSANOW, &newtio) == -1)
+        return openFailed(link, "tcsetattr", TRUE);
 
     printf("New termios structure set\n");
+    if (loopInit(&link->loop, link->fd) == -1)
+    {
+        loopClose(&link->loop);
+        return openFailed(link, "loopInit", TRUE);
+    }
+    memset(&link->stats, 0, sizeof(link->stats));
+    link->stats.baudRate = connectionParameters.baudRate;
+    link->openedAt = rtoNow();
+    link->closedAt = 0;
+    rtoInit(&link->rto, connectionParameters.timeout * 1000);
+    link->maxRetransmissions = connectionParameters.nRetransmissions;
+    decoderInit(&link->decoder);
+    link->fcs = FcsBcc;
+    link->fecParity = 0;
+    Frame frame;
     if(connectionParameters.role == LlTx){
         // Create string to send
     unsigned char buf[256] = {0};
-    buf[0] = FLAG;
-    buf[1] = A;
-    buf[2] = C;
-    buf[3] = BCC(buf[1],buf[2]);
-    buf[4] = F;
-    failed = 0;
+    int setSize = SET_SIZE;
+    if(link->options.maxPayload <= 0) link->options.maxPayload = MAX_PAYLOAD_SIZE;
+    if(link->options.window <= 0) link->options.window = defaultWindow(link->options.arq);
+    if(link->options.arq == ArqStopAndWait && link->options.fcs == FcsBcc &&
+       link->options.maxPayload == MAX_PAYLOAD_SIZE && link->options.transferId == 0 &&
+       link->options.fecParity == 0){
+        buf[0] = FLAG;
+        buf[1] = A;
+        buf[2] = C;
+        buf[3] = BCC(buf[1],buf[2]);
+        buf[4] = F;
+    }
+    else{
+        // SET carries the proposed options in its data field
+        unsigned char params[MAX_PARAMS_SIZE];
+        setSize = buildFrame(link, buf, C, params, encodeParams(params, link->options));
+    }
     int bytes = 0;
+    int received = FALSE;
+    int attempts = 0;
+    double sentAt = rtoNow();
     do{
-        STOP = FALSE;
-        bytes = write(fd, buf, SET_SIZE);
+        stop = FALSE;
+        bytes = writeFrame(link, buf, setSize);
         printf("%d bytes written\n", bytes);
-        alarm(connectionParameters.timeout);
-        alarm_enabled = TRUE;
-        printf("Attempt %d\n", alarm_count);
-        failed = 0;
-        state = START;
-        unsigned char aux = 0;
-        while (STOP == FALSE)
+        loopSetTimer(&link->loop, rtoCurrent(&link->rto));
+        printf("Attempt %d\n", attempts);
+        link->failed = 0;
+        while (stop == FALSE)
         {
-            bytes = read(fd, &aux, 1);
-            if( bytes > 0){
-                determineState(&state, aux, 1);
-            }
-            if (state == DONE || failed == 1){ 
-                    alarm(0);
-                    STOP = TRUE;
+            if(readFrame(link, &frame) && frame.type == FrameUa && frame.size >= 0)
+                received = TRUE;
+            if (received || link->failed == 1){ 
+                    loopSetTimer(&link->loop, 0);
+                    stop = TRUE;
                 }
         }
-    }while(alarm_count < connectionParameters.nRetransmissions && state != DONE);
+        if(!received){
+            printf("<Receiver didn't Answer>\n");
+            rtoBackoff(&link->rto);
+        }
+    }while(++attempts < connectionParameters.nRetransmissions && !received);
+    // SET/UA gives the first round-trip sample if the SET was sent once
+    if(received && attempts == 1) rtoSample(&link->rto, rtoNow() - sentAt);
+    else rtoReset(&link->rto);
     
-    if(state == DONE) printf("UA Received\n");
+    if(received) printf("UA Received\n");
     else {
         printf("UA Not Received\n");
-        return -1;
+        loopClose(&link->loop);
+        return openFailed(link, NULL, TRUE);
         }
 
+    // A plain UA means the receiver only speaks stop-and-wait
+    LinkOptions agreed = {ArqStopAndWait, 1, FcsBcc, MAX_PAYLOAD_SIZE, 0, 0, 0};
+    if(frame.hasData)
+        decodeParams(frame.data, frame.size, &agreed);
+    applyOptions(link, agreed);
     }
     else{  
 
-        // Loop for input
-        unsigned char aux = 0;
-        state = START;
-
         // RECEIVE SET
-        while (STOP == FALSE)
+        while (stop == FALSE)
         {
-            read(fd, &aux, 1);
-            determineState(&state, aux, 0);
-
-            if(state == DONE) STOP = TRUE;
+            if(readFrame(link, &frame) && frame.type == FrameSet && frame.size >= 0) stop = TRUE;
         }
         printf("Received SET");
 
         // Send UA
-        unsigned char msg[256] = {0};
-        msg[0] =  FLAG;
-        msg[1] = 0x03;
-        msg[2] = 0x07;
-        msg[3] = BCC(0x03,0x07);
-        msg[4] = FLAG;
-
-        int bytes= write(fd, msg, UA_SIZE);
+        unsigned char *msg = link->uaFrame;
+        int size = UA_SIZE;
+        LinkOptions agreed = {ArqStopAndWait, 1, FcsBcc, MAX_PAYLOAD_SIZE, 0, 0, 0};
+        if(frame.hasData){
+            // Accept the proposed mode, never a larger window or frame than
+            // configured here, whatever mode this side was set to
+            int maxWindow = (link->options.window > 0) ? link->options.window : MAX_WINDOW;
+            int maxPayload = (link->options.maxPayload > 0) ? link->options.maxPayload : MAX_LINK_PAYLOAD;
+            decodeParams(frame.data, frame.size, &agreed);
+            if(agreed.window > maxWindow) agreed.window = maxWindow;
+            if(agreed.maxPayload > maxPayload) agreed.maxPayload = maxPayload;
+            // resume only the transfer this side was interrupted in
+            agreed.resumeOffset = 0;
+            if(agreed.transferId != 0 && agreed.transferId == link->options.transferId)
+                agreed.resumeOffset = link->options.resumeOffset;
+            applyOptions(link, agreed);
+
+            unsigned char params[MAX_PARAMS_SIZE];
+            size = buildFrame(link, msg, C_RECEIVER, params, encodeParams(params, link->options));
+        }
+        else{
+            applyOptions(link, agreed);
+            msg[0] =  FLAG;
+            msg[1] = 0x03;
+            msg[2] = 0x07;
+            msg[3] = BCC(0x03,0x07);
+            msg[4] = FLAG;
+        }
+
+        link->uaSize = size;
+        int bytes= writeFrame(link, msg, size);
         printf(":%s:%d\n", msg, bytes);
     }
 
-    return fd; 
+    // frames after the handshake carry the agreed check value
+    link->fcs = link->options.fcs;
+    link->fecParity = link->options.fecParity;
+    decoderSetFcs(&link->decoder, link->fcs);
+    decoderSetFec(&link->decoder, link->fecParity);
+    return link;
+}
 
-    
+////////////////////////////////////////////////
+// ASYNCHRONOUS REQUESTS
+////////////////////////////////////////////////
+int queueCount(const AsyncQueue *queue)
+{
+    return queue->tail - queue->head;
 }
 
-void receiveACK(stateMachine* state,unsigned char byte, unsigned char * ack, int sn) {
+void queuePush(AsyncQueue *queue, LinkCompletion item)
+{
+    queue->items[queue->tail++ % ASYNC_QUEUE] = item;
+}
 
-    switch(*state){
-        case START:
-            if(byte == FLAG) *state = FLAG_RCV;
-            break;
+LinkCompletion *queueFront(AsyncQueue *queue)
+{
+    return &queue->items[queue->head % ASYNC_QUEUE];
+}
 
-        case FLAG_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == A) *state = A_RCV;
-            else *state = START;
-            break;
+LinkCompletion queuePop(AsyncQueue *queue)
+{
+    return queue->items[queue->head++ % ASYNC_QUEUE];
+}
 
-        case A_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == ACK(sn)) {
-                *state = C_RCV;
-                *ack = ACK(sn);
-            }
-            else if (byte == NACK(sn)) {
-                *state = C_RCV;
-                *ack = NACK(sn);
-            }
-            else *state = START;
+// Queues the completion of request, which never overflows since requests
+// are only accepted while fewer than ASYNC_QUEUE are pending
+void complete(LinkConnection *link, LinkCompletion request, int result)
+{
+    request.result = result;
+    queuePush(&link->asyncDone, request);
+    link->asyncCompleted++;
+}
 
-            
-            break;
+// Completes the submitted write sent as I-frame seq
+void completeWrite(LinkConnection *link, int seq, int acknowledged)
+{
+    LinkCompletion request = link->txRequests[seq];
+    complete(link, request, acknowledged ? request.result : -1);
+    link->txAsync[seq] = FALSE;
+}
 
-        case C_RCV:
-            if(byte == BCC(A, *ack))
-                *state = BCC_NORMAL;
-            else if(byte == FLAG_RCV){
-                *ack = FALSE;
-                *state = FLAG_RCV;
-            }
-            else{
-                *state = START;
-                *ack = FALSE;
-            }
-            break;
+////////////////////////////////////////////////
+// WINDOWED ARQ (GO-BACK-N, SELECTIVE REPEAT)
+////////////////////////////////////////////////
 
-        case BCC_NORMAL:
-            if(byte == FLAG) *state = DONE;
-            else{
-                *ack = FALSE;
-                *state = START;
-                
-            }
-            break;
-    }
-    
+int outstandingFrames(LinkConnection *link)
+{
+    return (link->sn - link->txBase + SEQ_MODULUS) % SEQ_MODULUS;
+}
+
+int inFlight(LinkConnection *link, int seq)
+{
+    return (seq - link->txBase + SEQ_MODULUS) % SEQ_MODULUS < outstandingFrames(link);
 }
 
+// Resends every frame in flight the receiver has not selectively acknowledged
+void resendWindow(LinkConnection *link)
+{
+    // the first copies may still be ahead of the oldest frame on the line
+    double aheadMs = 0;
+    for(int seq = link->txBase; seq != link->sn; seq = (seq + 1) % SEQ_MODULUS){
+        aheadMs += frameLineMs(link, seq);
+        if(link->txAcked[seq]) continue;
+        sendInformation(link, seq);
+        link->txResent[seq] = FALSE;
+        link->txRetransmitted[seq] = TRUE;
+        link->stats.retransmissions++;
+    }
+    loopSetTimer(&link->loop, frameTimeout(link, link->txBase) + (int)aheadMs);
+}
 
+/**
+ * @brief Slides the window up to N(R) received in an RR or REJ
+ *
+ * @return FALSE if nr does not acknowledge a frame in flight
+ */
+int acknowledgeUpTo(LinkConnection *link, int nr)
+{
+    if((nr - link->txBase + SEQ_MODULUS) % SEQ_MODULUS > outstandingFrames(link))
+        return FALSE;
+    if(nr != link->txBase){
+        // the newest frame acknowledged gives the round-trip sample
+        int last = (nr - 1 + SEQ_MODULUS) % SEQ_MODULUS;
+        if(!link->txRetransmitted[last]) sampleRoundTrip(link, last);
+        else rtoReset(&link->rto);
+        for(; link->txBase != nr; link->txBase = (link->txBase + 1) % SEQ_MODULUS){
+            if(link->txAsync[link->txBase]) completeWrite(link, link->txBase, TRUE);
+            link->txAcked[link->txBase] = FALSE;
+            link->txResent[link->txBase] = FALSE;
+        }
+        link->txAttempts = 0;
+        if(outstandingFrames(link) > 0) loopSetTimer(&link->loop, frameTimeout(link, link->txBase));
+        else loopSetTimer(&link->loop, 0);
+    }
+    return TRUE;
+}
 
+/**
+ * @brief Handles SACK(nr) with a bitmap of the frames received after nr:
+ * bit i set means frame nr + 1 + i is buffered at the receiver.
+ * Only the first missing frame and the gaps below the highest frame
+ * received are resent, each once per gap.
+ */
+void selectiveAck(LinkConnection *link, int nr, unsigned char bitmap)
+{
+    if(!acknowledgeUpTo(link, nr)) return;
+    int last = -1;
+    for(int i = 0; i < 8; i++){
+        int seq = (nr + 1 + i) % SEQ_MODULUS;
+        if((bitmap & (1 << i)) && inFlight(link, seq)){
+            link->txAcked[seq] = TRUE;
+            last = i;
+        }
+    }
+    for(int i = -1; i < last || i == -1; i++){
+        int seq = (nr + 1 + i) % SEQ_MODULUS;
+        if(!inFlight(link, seq) || link->txAcked[seq] || link->txResent[seq]) continue;
+        printf("Resending frame %d...\n", seq);
+        sendInformation(link, seq);
+        link->txResent[seq] = TRUE;
+        link->txRetransmitted[seq] = TRUE;
+        link->stats.retransmissions++;
+    }
+}
 
-int llwrite(const unsigned char *buf, int bufSize)
+/**
+ * @brief Processes the RR/REJ/SACK frames sent back by the receiver and the
+ * retransmission timer. Only waits for the line if block is TRUE.
+ *
+ * @return -1 once the frames in flight were retransmitted nRetransmissions times
+ */
+int serviceWindow(LinkConnection *link, int block)
 {
-    int attemptNumber = 0;
-    int done = FALSE;
-    signal(SIGALRM, alarmHandler);
-    state = START;
-
-    // counting number in the middle
-    unsigned int count = 0;
-
-    for(int i = 0; i < bufSize; i++){
-        if(buf[i] == FLAG || buf[i] == ESC)
-            count++;
-    }
-
-    unsigned int size = bufSize + 6 + count;
-    unsigned char msg[size];
-    for(int i = 0; i < size; i++){
-        msg[i]=0;
-    }
-
-    msg[0] = FLAG;
-    msg[1] = A;
-    msg[2] = sn << 7;
-    msg[3] = BCC(A, sn << 7);
-    unsigned int i = 0, BCC2=0;
-
-    // byte stuffing
-    for (int j = 0; j < bufSize; j++) {
-        switch (buf[j]) {
-            case FLAG:
-                msg[j + i + 4] = ESC;
-                msg[j + i + 5] = FLAG;
-                BCC2 = BCC(BCC2, FLAG);
-                i++;
+    Frame frame;
+    while(TRUE){
+        if(link->failed){
+            link->failed = FALSE;
+            if(outstandingFrames(link) == 0) continue;
+            if(link->txAttempts++ == link->maxRetransmissions) return -1;
+            printf("Timeout, going back to frame %d\n", link->txBase);
+            rtoBackoff(&link->rto);
+            resendWindow(link);
+            if(block) return 0;
+        }
+        if(!nextFrame(link, &frame)){
+            if(!waitLine(link, block ? -1 : 0)) return 0;
+            continue;
+        }
+
+        switch(frame.type){
+            case FrameRr:
+                acknowledgeUpTo(link, frame.seq);
+                break;
+
+            case FrameRej:
+                link->stats.rejReceived++;
+                if(!acknowledgeUpTo(link, frame.seq)) break;
+                printf("RECEIVED REJ(%d), going back...\n", frame.seq);
+                resendWindow(link);
                 break;
 
-            case ESC:
-                msg[j + i + 4] = ESC;
-                msg[j + i + 5] = ESC;
-                BCC2 = BCC(BCC2, ESC);
-                i++;
+            case FrameSack:
+                if(frame.size >= 1) selectiveAck(link, frame.seq, frame.data[0]);
                 break;
 
+            case FrameDisc:
+                printf("Receiver disconnected\n");
+                return -1;
+
             default:
-                msg[j + i + 4] = buf[j];
-                BCC2 = BCC(BCC2, buf[j]);
+                break;
         }
+        if(block) return 0;
     }
-    msg[i+bufSize+ 4] = BCC2;
-    msg[i+bufSize+ 5] = FLAG;
-    alarm_enabled = FALSE;
-    STOP = FALSE;
-    while(state != DONE && STOP != TRUE) {
-        unsigned char received;
-        unsigned char ack;
-        
-        if (alarm_enabled == FALSE) {
-            if(attemptNumber == 4) return -1;
-            attemptNumber ++;
-            write(fd, msg, size);
-            signal(SIGALRM, alarmHandler);
-            alarm(3);
-            alarm_enabled = TRUE;
+    return 0;
+}
+
+// Sends the I-frame queued in slot sn once the window has room
+int llwriteWindowed(LinkConnection *link)
+{
+    while(outstandingFrames(link) == link->options.window){
+        if(serviceWindow(link, TRUE) < 0) return -1;
+    }
+
+    link->txAcked[link->sn] = FALSE;
+    link->txResent[link->sn] = FALSE;
+    link->txRetransmitted[link->sn] = FALSE;
+    link->txAsync[link->sn] = FALSE;
+    link->txSentAt[link->sn] = rtoNow();
+    sendInformation(link, link->sn);
+    if(outstandingFrames(link) == 0) loopSetTimer(&link->loop, frameTimeout(link, link->sn));
+    link->sn = (link->sn + 1) % SEQ_MODULUS;
+
+    if(serviceWindow(link, FALSE) < 0) return -1;
+    return 0;
+}
+
+// Waits until every frame in flight has been acknowledged
+int drainWindow(LinkConnection *link)
+{
+    while(outstandingFrames(link) > 0){
+        if(serviceWindow(link, TRUE) < 0) return -1;
+    }
+    return 0;
+}
+
+// Go-Back-N: only the expected frame is delivered, the first one out of
+// order asks for it again with REJ
+int takeWindowed(LinkConnection *link, const Frame *frame, unsigned char *packet)
+{
+    int ns = frame->seq;
+    if(ns == link->sn && frame->size >= 0){
+        memcpy(packet, frame->data, frame->size);
+        link->sn = (link->sn + 1) % SEQ_MODULUS;
+        link->rxRejSent = FALSE;
+        sendSupervision(link, ACK(link->sn));
+        return frame->size;
+    }
+    // a frame ahead of the expected one means the expected one was lost
+    int ahead = (ns - link->sn + SEQ_MODULUS) % SEQ_MODULUS < link->options.window;
+    if(ahead || ns == link->sn){
+        if(!link->rxRejSent){
+            printf("Sending REJ(%d)...\n", link->sn);
+            sendSupervision(link, NACK(link->sn));
+            link->stats.rejSent++;
+            link->rxRejSent = TRUE;
         }
+    }
+    // duplicate of a frame already delivered, its RR was lost
+    else{
+        link->stats.duplicates++;
+        sendSupervision(link, ACK(link->sn));
+    }
+    return NO_PACKET;
+}
 
-        unsigned int bytes = read(fd, &received, 1);
-        if( bytes > 0){
-            receiveACK(&state, received, &ack, 1-sn);
-            
+// First sequence number not yet received (everything before it is buffered
+// or already delivered)
+int nextMissing(LinkConnection *link)
+{
+    int nr = link->sn;
+    while(link->rxSizes[nr] >= 0 && (nr - link->sn + SEQ_MODULUS) % SEQ_MODULUS < link->options.window)
+        nr = (nr + 1) % SEQ_MODULUS;
+    return nr;
+}
 
-            if (state == DONE && ack == ACK(1-sn)){
-                sn = 1-sn;
-                alarm(0);
-                STOP = TRUE;
+/**
+ * @brief Acknowledges everything before the first missing frame. If frames
+ * after it are buffered, or gap is TRUE, replies with SACK and a bitmap of
+ * the frames received instead of a plain RR.
+ */
+void sendSelectiveAck(LinkConnection *link, int gap)
+{
+    int nr = nextMissing(link);
+    unsigned char bitmap = 0;
+    for(int i = 0; i < link->options.window - 1; i++){
+        if(link->rxSizes[(nr + 1 + i) % SEQ_MODULUS] >= 0) bitmap |= 1 << i;
+    }
+    if(bitmap == 0 && !gap){
+        sendSupervision(link, ACK(nr));
+        return;
+    }
+    if(gap) link->stats.rejSent++;
+    unsigned char frame[SACK_FRAME_SIZE];
+    writeFrame(link, frame, buildFrame(link, frame, SACK(nr), &bitmap, 1));
+}
+
+// Hands the next in-order frame of the reorder buffer to the caller
+int deliverBuffered(LinkConnection *link, unsigned char *packet)
+{
+    int size = link->rxSizes[link->sn];
+    memcpy(packet, link->rxFrames[link->sn], size);
+    link->rxSizes[link->sn] = -1;
+    link->sn = (link->sn + 1) % SEQ_MODULUS;
+    return size;
+}
+
+// Selective Repeat: frames are buffered until the ones before them arrive
+int takeSelective(LinkConnection *link, const Frame *frame, unsigned char *packet)
+{
+    int ns = frame->seq;
+    int offset = (ns - nextMissing(link) + SEQ_MODULUS) % SEQ_MODULUS;
+    if(offset >= link->options.window){
+        // duplicate of a frame already acknowledged
+        link->stats.duplicates++;
+        sendSelectiveAck(link, FALSE);
+        return NO_PACKET;
+    }
+    if(frame->size < 0){
+        sendSelectiveAck(link, TRUE);
+        return NO_PACKET;
+    }
+    if(link->rxSizes[ns] < 0){
+        memcpy(link->rxFrames[ns], frame->data, frame->size);
+        link->rxSizes[ns] = frame->size;
+    }
+    else link->stats.duplicates++;
+    sendSelectiveAck(link, FALSE);
+    if(link->rxSizes[link->sn] >= 0) return deliverBuffered(link, packet);
+    return NO_PACKET;
+}
+
+
+// Sends the I-frame queued in slot sn and waits for its RR
+int llwriteStopAndWait(LinkConnection *link)
+{
+    int attemptNumber = 0;
+    int retransmitted = FALSE;
+
+    // stuffed once into the wire buffer, kept there for retransmissions
+    unsigned char *msg = link->txWire;
+    unsigned int size = buildInformation(link, msg, link->sn);
+    link->failed = TRUE; // first transmission
+    int stop = FALSE;
+    while(stop != TRUE) {
+        Frame frame;
+        
+        if (link->failed) {
+            if(attemptNumber > link->maxRetransmissions) return -1;
+            if(attemptNumber > 0){
+                printf("<Receiver didn't Answer>\n");
+                rtoBackoff(&link->rto);
+            }
+            else link->txSentAt[link->sn] = rtoNow();
+            retransmitted = attemptNumber++ > 0;
+            if(retransmitted) link->stats.retransmissions++;
+            writeFrame(link, msg, size);
+            loopSetTimer(&link->loop, frameTimeout(link, link->sn));
+            link->failed = FALSE;
+        }
+
+        if(readFrame(link, &frame)){
+            if (frame.type == FrameRr && frame.seq == 1-link->sn){
+                // Karn: only frames sent once give a round-trip sample
+                if(!retransmitted) sampleRoundTrip(link, link->sn);
+                else rtoReset(&link->rto);
+                link->sn = 1-link->sn;
+                loopSetTimer(&link->loop, 0);
+                stop = TRUE;
                 printf("RECEIVED ACK aka RR...\n");
             }
             // se  ack==NACK, tenho de reenviar
-            else if(state == DONE){
+            else if(frame.type == FrameRej && frame.seq == 1-link->sn){
                 printf("RECEIVED NACK aka RREJ...\n");
-                write(fd, msg, size);
-                state = START;
+                link->stats.rejReceived++;
+                link->stats.retransmissions++;
+                retransmitted = TRUE;
+                writeFrame(link, msg, size);
+                loopSetTimer(&link->loop, frameTimeout(link, link->sn));
             } 
+            else if(frame.type == FrameDisc){
+                printf("Receiver disconnected\n");
+                return -1;
+            }
         } 
         
         
@@ -360,191 +992,492 @@ int llwrite(const unsigned char *buf, int bufSize)
     return 0;
 }
 
+// Sends the I-frame queued in slot sn once, nothing comes back
+int llwriteUnacknowledged(LinkConnection *link)
+{
+    if(sendInformation(link, link->sn) < 0) return -1;
+    link->sn = (link->sn + 1) % SEQ_MODULUS;
+    return 0;
+}
+
+// Windowed modes keep I-frames in flight until acknowledged
+int windowed(LinkConnection *link)
+{
+    return link->options.arq == ArqGoBackN || link->options.arq == ArqSelectiveRepeat;
+}
+
+// Sends the count segments (size bytes in all) as I-frame sn
+int writeSegments(LinkConnection *link, const struct iovec *segments, int count, int size)
+{
+    link->txSegments[link->sn] = segments;
+    link->txSegmentCounts[link->sn] = count;
+    int result;
+    if(link->options.arq == ArqNone) result = llwriteUnacknowledged(link);
+    else if(link->options.arq != ArqStopAndWait) result = llwriteWindowed(link);
+    else result = llwriteStopAndWait(link);
+    if(result == 0) link->stats.dataBytesSent += size;
+    return result;
+}
+
+int llwritepacket_r(LinkConnection *link, const unsigned char *header, int headerSize,
+                  const unsigned char *data, int dataSize)
+{
+    if(headerSize > MAX_PACKET_HEADER || headerSize + dataSize > link->options.maxPayload)
+        return -1;
+    struct iovec *parts = link->txParts[link->sn];
+    if(headerSize > 0) memcpy(link->txHeaders[link->sn], header, headerSize);
+    parts[0].iov_base = link->txHeaders[link->sn];
+    parts[0].iov_len = headerSize;
+    parts[1].iov_base = (void *)data;
+    parts[1].iov_len = dataSize;
+    return writeSegments(link, parts, 2, headerSize + dataSize);
+}
+
+int llwritev_r(LinkConnection *link, const struct iovec *iov, int iovcnt)
+{
+    size_t size = 0;
+    for(int i = 0; i < iovcnt; i++) size += iov[i].iov_len;
+    if(iovcnt < 0 || size > (size_t)link->options.maxPayload) return -1;
+    // stop-and-wait and unacknowledged frames are done with when we return,
+    // so they are stuffed straight from the caller's segments
+    if(!windowed(link)) return writeSegments(link, iov, iovcnt, size);
+
+    // the caller may reuse them, keep a copy until acknowledged
+    unsigned char *copy = link->txCopy[link->sn];
+    int n = 0;
+    for(int i = 0; i < iovcnt; i++){
+        memcpy(copy + n, iov[i].iov_base, iov[i].iov_len);
+        n += iov[i].iov_len;
+    }
+    struct iovec *parts = link->txParts[link->sn];
+    parts[0].iov_base = copy;
+    parts[0].iov_len = size;
+    return writeSegments(link, parts, 1, size);
+}
+
+int llwrite_r(LinkConnection *link, const unsigned char *buf, int bufSize)
+{
+    if(bufSize < 0) return -1;
+    struct iovec segment = {(void *)buf, bufSize};
+    return llwritev_r(link, &segment, 1);
+}
+
+int lldrain_r(LinkConnection *link)
+{
+    if(!windowed(link)) return 0;
+    return drainWindow(link);
+}
+
 
 ////////////////////////////////////////////////
 // LLREAD
 ////////////////////////////////////////////////
 
 
+// Stop-and-wait: the expected frame is acknowledged and delivered, a
+// repeated one acknowledged again and a bad one rejected
+int takeStopAndWait(LinkConnection *link, const Frame *frame, unsigned char *packet)
+{
+    // a receber uma mensagem repetida, e a querer a proxima (houve um erro)
+    if(frame->seq != link->sn){
+        // mandar ack, proveniente de mensagens repetidas
+        printf("Sending ACK because repeated message...\n");
+        link->stats.duplicates++;
+        sendSupervision(link, ACK(link->sn));
+        return NO_PACKET;
+    }
+
+    // BCC2 tem de ser igual ao XOR dos dados
+    if(frame->size < 0){
+        //mandar nack
+        printf("Sending NACK or RRej...\n");
+        link->stats.rejSent++;
+        sendSupervision(link, NACK(1-link->sn));
+        return NO_PACKET;
+    }
+    memcpy(packet, frame->data, frame->size);
+
+    //mandar ack
+    printf("Sending ACK everything in order...\n");
+    link->sn = 1-link->sn;
+    sendSupervision(link, ACK(link->sn));
+    return frame->size;
+}
+
+// No ARQ: frames that pass their check are delivered in the order they
+// come. Bad frames are dropped without a REJ, and a frame the line repeated
+// is delivered once.
+int takeUnacknowledged(LinkConnection *link, const Frame *frame, unsigned char *packet)
+{
+    if(frame->size < 0) return NO_PACKET;
+    if(frame->seq == link->rxLastSeq){
+        link->stats.duplicates++;
+        return NO_PACKET;
+    }
+    link->rxLastSeq = frame->seq;
+    memcpy(packet, frame->data, frame->size);
+    return frame->size;
+}
+
 /**
- * @brief
- * 
- * @param packet 
- * @param sn 
- * @return true se for para mandar um ack, false se for para mandar um nack
+ * @brief Hands a frame from the line to the receiver of the agreed ARQ mode,
+ * which answers it and may complete the next packet in packet.
+ *
+ * @return size of the packet, NO_PACKET if none is ready, or -1 if the
+ * transmitter disconnected
  */
-int receiveData(unsigned char *packet, int sn, size_t *size_read) {
-
-    state = START;  
-    unsigned char C_CONTROL = sn << 7;  //sn
-    unsigned char C_REPLY = (1-sn) << 7;   // nr
-    unsigned int i=0, BCC2 = 0, stuffing = 0;  // meter a 1 sempre for enviado um ESC
-    while(state != DONE){
-
-        unsigned char received;
-        unsigned int bytes = read(fd, &received, 1);
-
-        if( bytes > 0){
-            switch(state){
-                case START:
-                    if( received == FLAG) state = FLAG_RCV;
-                    break;
-
-                case FLAG_RCV:
-                    if(received  == FLAG) state = FLAG_RCV;
-                    else if(received  == A) state = A_RCV;
-                    else state = START;
-                    break;
-
-                case A_RCV:
-                    if(received  == FLAG) state = FLAG_RCV;
-                    else if(received == C_CONTROL){
-                        state = C_RCV;
-                    }
-                    // a receber uma mensagem repetida, e a querer a proxima (houve um erro)
-                    else if(C_REPLY == received ){
-                        // mandar um ack, para passar para a prox mensagem 
-                        return REPEATED_MESSAGE;
-                    }
-                    else state = START;
-                    break;
-
-                case C_RCV:
-                    if(received  == FLAG) state = FLAG_RCV;
-                    else if(received  == BCC(A, C_CONTROL)) state = BCC_DATA;
-                    else state = START;
-                    break;
-
-                //stuffing
-                case BCC_DATA:
-                    if(!stuffing){
-                        if(received  == FLAG){
-                            state = DONE;
-                            
-                            BCC2 = BCC(BCC2, packet[i-1]);
-                            size_read = i-1;
-                            return (BCC2 == packet[i-1]); 
-                            // ser igual ao penultimo byte antes da flag
-                        } 
-                        else if(received  == ESC) stuffing = TRUE;
-                        else{
-                            BCC2 = BCC(BCC2, received );
-                            packet[i] = received ;
-                            i++;
-                        }
-                    }
-                    else{
-                        stuffing = FALSE;
-                        BCC2 = BCC(BCC2, received );
-                        packet[i] = received ;
-                        i++;
-                    }
-                    break;
-            }
-        }
-        
-        
+int takeFrame(LinkConnection *link, const Frame *frame, unsigned char *packet)
+{
+    if(frame->type != FrameInfo)
+        return (answerControlFrame(link, frame) < 0) ? -1 : NO_PACKET;
+    switch(link->options.arq){
+        case ArqNone: return takeUnacknowledged(link, frame, packet);
+        case ArqSelectiveRepeat: return takeSelective(link, frame, packet);
+        case ArqGoBackN: return takeWindowed(link, frame, packet);
+        default: return takeStopAndWait(link, frame, packet);
+    }
+}
+
+// A packet Selective Repeat already holds, or NO_PACKET
+int bufferedPacket(LinkConnection *link, unsigned char *packet)
+{
+    if(link->options.arq == ArqSelectiveRepeat && link->rxSizes[link->sn] >= 0)
+        return deliverBuffered(link, packet);
+    return NO_PACKET;
+}
+
+// Counts a packet delivered to the caller
+void delivered(LinkConnection *link, int size)
+{
+    link->stats.infoFramesReceived++;
+    link->stats.dataBytesReceived += size;
+}
+
+int llread_r(LinkConnection *link, unsigned char *packet)
+{
+    Frame frame;
+    int size = bufferedPacket(link, packet);
+    while(size == NO_PACKET){
+        if(readFrame(link, &frame)) size = takeFrame(link, &frame, packet);
     }
+    if(size >= 0) delivered(link, size);
+    return size;
+}
+
+////////////////////////////////////////////////
+// ASYNCHRONOUS INTERFACE
+////////////////////////////////////////////////
+void llsetcallback_r(LinkConnection *link, LinkCallback callback, void *arg)
+{
+    link->callback = callback;
+    link->callbackArg = arg;
+}
 
-    return FALSE;
+int llsubmitwrite_r(LinkConnection *link, const unsigned char *buf, int bufSize, void *tag)
+{
+    if(link->role != LlTx || link->asyncFailed || link->asyncRequests == ASYNC_QUEUE ||
+       bufSize > link->options.maxPayload)
+        return -1;
+    LinkCompletion request = {LinkWrite, tag, (unsigned char *)buf, bufSize};
+    queuePush(&link->asyncWrites, request);
+    link->asyncRequests++;
+    return 0;
+}
 
+int llsubmitread_r(LinkConnection *link, unsigned char *buf, void *tag)
+{
+    if(link->role != LlRx || link->asyncFailed || link->asyncRequests == ASYNC_QUEUE)
+        return -1;
+    LinkCompletion request = {LinkRead, tag, buf, 0};
+    queuePush(&link->asyncReads, request);
+    link->asyncRequests++;
+    return 0;
 }
 
+int llcompletions_r(LinkConnection *link, LinkCompletion *completions, int max)
+{
+    int n = 0;
+    while(n < max && queueCount(&link->asyncDone) > 0) completions[n++] = queuePop(&link->asyncDone);
+    link->asyncRequests -= n;
+    return n;
+}
 
+int llpollfd_r(LinkConnection *link)
+{
+    return link->loop.epfd;
+}
 
-int llread(unsigned char *packet)
+// The link gave up: every request in flight or queued fails
+void failRequests(LinkConnection *link)
 {
-    int reply;
-    size_t size_read;
-    while( (reply = receiveData(packet, sn, &size_read)) != TRUE){
-        //mandar nack
-        if( reply == 0){
-            printf("Sending NACK or RRej...\n");
-            unsigned char C_NACK = NACK(1-sn);
-            unsigned char buf[] = {FLAG, A, C_NACK, BCC(A, C_NACK), F};
-            write(fd, buf, 5);
+    link->asyncFailed = TRUE;
+    loopSetTimer(&link->loop, 0);
+    for(int seq = link->txBase; seq != link->sn; seq = (seq + 1) % SEQ_MODULUS){
+        if(link->txAsync[seq]) completeWrite(link, seq, FALSE);
+    }
+    if(link->asyncBusy) completeWrite(link, link->sn, FALSE);
+    link->asyncBusy = FALSE;
+    link->txBase = link->sn;
+    while(queueCount(&link->asyncWrites) > 0) complete(link, queuePop(&link->asyncWrites), -1);
+    while(queueCount(&link->asyncReads) > 0) complete(link, queuePop(&link->asyncReads), -1);
+}
+
+/**
+ * @brief Stop-and-wait for submitted writes: takes the RR/REJ of the frame
+ * in flight and the retransmission timer, without waiting.
+ *
+ * @return -1 once the frame was retransmitted nRetransmissions times
+ */
+int serviceStopAndWait(LinkConnection *link)
+{
+    Frame frame;
+    while(link->asyncBusy){
+        int seq = link->sn;
+        if(link->failed){
+            link->failed = FALSE;
+            if(link->txAttempts++ == link->maxRetransmissions) return -1;
+            printf("<Receiver didn't Answer>\n");
+            rtoBackoff(&link->rto);
+            link->txRetransmitted[seq] = TRUE;
+            link->stats.retransmissions++;
+            sendInformation(link, seq);
+            loopSetTimer(&link->loop, frameTimeout(link, seq));
+            continue;
         }
-        // mandar ack, proveniente de mensagens repetidas
-        else{
-            printf("Sending ACK because repeated message...\n");
-            unsigned char C_ACK = ACK(sn);
-            unsigned char buf[] = {FLAG, A, C_ACK, BCC(A, C_ACK), F};
-             write(fd, buf, 5);
+        if(!nextFrame(link, &frame)){
+            if(!waitLine(link, 0)) return 0;
+            continue;
+        }
+        if(frame.type == FrameRr && frame.seq == 1-seq){
+            if(!link->txRetransmitted[seq]) sampleRoundTrip(link, seq);
+            else rtoReset(&link->rto);
+            loopSetTimer(&link->loop, 0);
+            completeWrite(link, seq, TRUE);
+            link->sn = 1-seq;
+            link->asyncBusy = FALSE;
+        }
+        else if(frame.type == FrameRej && frame.seq == 1-seq){
+            link->stats.rejReceived++;
+            link->stats.retransmissions++;
+            link->txRetransmitted[seq] = TRUE;
+            sendInformation(link, seq);
+            loopSetTimer(&link->loop, frameTimeout(link, seq));
+        }
+        else if(frame.type == FrameDisc){
+            printf("Receiver disconnected\n");
+            return -1;
         }
     }
-    //mandar ack
-    printf("Sending ACK everything in order...\n");
-    sn = 1-sn;
-    unsigned char C_ACK = ACK(sn);
-    unsigned char buf[] = {FLAG, A, C_ACK, BCC(A, C_ACK), F};
-    write(fd, buf, 5);
-
-    return size_read;
+    return 0;
 }
 
-////////////////////////////////////////////////
-// LLCLOSE
-////////////////////////////////////////////////
-void determineStateDISC(stateMachine *state, char byte)
+// Room for another I-frame: the window is not full, or nothing is in
+// flight with stop-and-wait
+int canSend(LinkConnection *link)
 {
-    unsigned char A_FLAG = 0x03;
-    unsigned char C_FLAG = 0x0B;
+    if(link->options.arq == ArqNone) return TRUE;
+    if(link->options.arq == ArqStopAndWait) return !link->asyncBusy;
+    return outstandingFrames(link) < link->options.window;
+}
 
-    switch(*state){
-        case START:
-            if( byte == FLAG) *state = FLAG_RCV;
+// Sends the oldest submitted write as I-frame sn
+void sendSubmitted(LinkConnection *link)
+{
+    LinkCompletion request = queuePop(&link->asyncWrites);
+    int seq = link->sn;
+    int idle = outstandingFrames(link) == 0;
+    link->txParts[seq][0].iov_base = request.buf;
+    link->txParts[seq][0].iov_len = request.result;
+    link->txSegments[seq] = link->txParts[seq];
+    link->txSegmentCounts[seq] = 1;
+    link->txRequests[seq] = request;
+    link->txAsync[seq] = TRUE;
+    link->txAcked[seq] = FALSE;
+    link->txResent[seq] = FALSE;
+    link->txRetransmitted[seq] = FALSE;
+    link->txSentAt[seq] = rtoNow();
+    sendInformation(link, seq);
+    link->stats.dataBytesSent += request.result;
+
+    switch(link->options.arq){
+        case ArqNone:
+            completeWrite(link, seq, TRUE);
+            link->sn = (seq + 1) % SEQ_MODULUS;
             break;
-
-        case FLAG_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == A_FLAG) *state = A_RCV;
-            else *state = START;
+        case ArqStopAndWait:
+            link->asyncBusy = TRUE;
+            link->txAttempts = 0;
+            link->failed = FALSE;
+            loopSetTimer(&link->loop, frameTimeout(link, seq));
             break;
-
-        case A_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == C_FLAG) *state = C_RCV;
-            else *state = START;
+        default:
+            if(idle) loopSetTimer(&link->loop, frameTimeout(link, seq));
+            link->sn = (seq + 1) % SEQ_MODULUS;
             break;
+    }
+}
 
-        case C_RCV:
-            if(byte == FLAG) *state = FLAG_RCV;
-            else if(byte == BCC(A_FLAG, C_FLAG)) *state = BCC_NORMAL;
-            else *state = START;
-            break;
+// Acknowledgements and timeouts first, they may make room for more frames
+void writeSubmitted(LinkConnection *link)
+{
+    int result = 0;
+    if(windowed(link)) result = serviceWindow(link, FALSE);
+    else if(link->options.arq == ArqStopAndWait) result = serviceStopAndWait(link);
+    if(result < 0){
+        failRequests(link);
+        return;
+    }
+    while(queueCount(&link->asyncWrites) > 0 && canSend(link)) sendSubmitted(link);
+}
 
-        case BCC_NORMAL:
-            if(byte == FLAG)  *state = DONE;
-            else *state = START;
-            break;
+// Fills the buffers submitted with the packets the line completes
+void readSubmitted(LinkConnection *link)
+{
+    Frame frame;
+    while(queueCount(&link->asyncReads) > 0){
+        unsigned char *packet = queueFront(&link->asyncReads)->buf;
+        int size = bufferedPacket(link, packet);
+        if(size == NO_PACKET){
+            if(!nextFrame(link, &frame)){
+                if(!waitLine(link, 0)) return;
+                continue;
+            }
+            size = takeFrame(link, &frame, packet);
+        }
+        if(size == NO_PACKET) continue;
+        if(size < 0){
+            failRequests(link);
+            return;
+        }
+        delivered(link, size);
+        complete(link, queuePop(&link->asyncReads), size);
     }
+}
 
+void stepSubmitted(LinkConnection *link)
+{
+    if(link->asyncFailed) return;
+    if(link->role == LlTx) writeSubmitted(link);
+    else readSubmitted(link);
 }
 
-int llclose(int statistics, LinkLayer linkLayer)
+int llprogress_r(LinkConnection *link, int waitMs)
 {
-    int bytes = 0;
+    link->asyncCompleted = 0;
+    stepSubmitted(link);
+    // only wait while some request can still complete
+    int pending = link->asyncRequests > queueCount(&link->asyncDone);
+    if(link->asyncCompleted == 0 && waitMs != 0 && pending && !link->asyncFailed){
+        waitLine(link, waitMs);
+        stepSubmitted(link);
+    }
+    int completed = link->asyncCompleted;
+
+    // callbacks last, so they may submit more
+    while(link->callback != NULL && queueCount(&link->asyncDone) > 0){
+        LinkCompletion completion = queuePop(&link->asyncDone);
+        link->asyncRequests--;
+        link->callback(link, &completion, link->callbackArg);
+    }
+    return completed;
+}
+
+////////////////////////////////////////////////
+// STATISTICS
+////////////////////////////////////////////////
+LinkStatistics llgetstatistics_r(LinkConnection *link)
+{
+    LinkStatistics s = link->stats;
+    s.seconds = ((link->closedAt > 0 ? link->closedAt : rtoNow()) - link->openedAt) / 1000.0;
+    unsigned long long data = s.dataBytesSent + s.dataBytesReceived;
+    if(s.seconds > 0) s.goodput = data * 8 / s.seconds;
+    if(s.baudRate > 0) s.efficiency = s.goodput / s.baudRate;
+
+    // time to send an average I-frame (the transmitter knows their size on
+    // the wire, the receiver only their data) and the propagation delay:
+    // the smoothed round-trip time is already net of the line time of the
+    // frames and their RRs (sampleRoundTrip()), so half of it
+    double frameBytes = 0;
+    if(s.infoFramesSent > 0) frameBytes = (double)s.infoBytesSent / s.infoFramesSent;
+    else if(s.infoFramesReceived > 0)
+        frameBytes = (double)s.dataBytesReceived / s.infoFramesReceived + 5 + fcsSize(link->options.fcs);
+    if(s.baudRate > 0 && frameBytes > 0){
+        double frameMs = lineTimeMs(link, frameBytes);
+        double propagationMs = link->rto.srtt / 2;
+        s.stopAndWaitEfficiency = 1 / (1 + 2 * propagationMs / frameMs);
+    }
+    return s;
+}
+
+void printStatistics(LinkConnection *link, LinkLayerRole role)
+{
+    LinkStatistics s = llgetstatistics_r(link);
+    printf("\n--- Statistics ---\n");
+    printf("Time: %.3f s\n", s.seconds);
+    printf("Frames sent: %llu (%llu bytes), I-frames: %llu (%llu bytes)\n",
+           s.framesSent, s.bytesSent, s.infoFramesSent, s.infoBytesSent);
+    printf("Frames received: %llu (%llu bytes), I-frames: %llu, bad: %llu\n",
+           s.framesReceived, s.bytesReceived, s.infoFramesReceived, s.badFrames);
+    printf("Stuffing overhead: %llu bytes (%.2f%% of bytes sent)\n", s.stuffingBytes,
+           s.bytesSent > 0 ? 100.0 * s.stuffingBytes / s.bytesSent : 0.0);
+    printf("Retransmissions: %llu, timeouts: %llu\n", s.retransmissions, s.timeouts);
+    printf("REJ sent: %llu, received: %llu, duplicate frames: %llu\n",
+           s.rejSent, s.rejReceived, s.duplicates);
+    if(link->options.fecParity > 0)
+        printf("FEC: %d parity bytes per block, %llu bytes corrected in %llu frames\n",
+               link->options.fecParity, s.fecBytes, s.fecFrames);
+    printf("Goodput: %.0f bit/s (%llu data bytes)\n", s.goodput,
+           s.dataBytesSent + s.dataBytesReceived);
+    printf("Efficiency: %.4f at %d baud, stop-and-wait: %.4f\n",
+           s.efficiency, s.baudRate, s.stopAndWaitEfficiency);
+    if(role == LlTx){
+        printf("Round-trip samples: %d\n", link->rto.samples);
+        printf("SRTT: %.2f ms, RTTVAR: %.2f ms\n", link->rto.srtt, link->rto.rttvar);
+        printf("RTO: %d ms\n", rtoCurrent(&link->rto));
+    }
+}
+
+////////////////////////////////////////////////
+// LLCLOSE
+////////////////////////////////////////////////
+// The DISC/UA exchange and the port restored, link is kept for its
+// statistics
+int disconnect(LinkConnection *link, int statistics)
+{
+    int stop;
     unsigned char msg[256] = {0};
-    unsigned char aux = 0;
-    switch (linkLayer.role)
+    Frame frame;
+    int attempts = 0;
+    link->failed = FALSE;
+    switch (link->role)
     {
         case LlTx:
+            if(windowed(link) && drainWindow(link) < 0)
+                printf("Frames in flight were not acknowledged\n");
+            loopSetTimer(&link->loop, 0);
             // Send DISC
             msg[0] =  FLAG;
             msg[1] = 0x03;
             msg[2] = 0x0B;
             msg[3] = BCC(0x03,0x0B);
             msg[4] = FLAG;
-            bytes= write(fd, msg, 5);
-            printf("Sent Disconnect Flag\n", msg, bytes);
-            state = START;
-            STOP = FALSE;
-            while (STOP == FALSE)
+            writeFrame(link, msg, 5);
+            printf("Sent Disconnect Flag\n");
+            loopSetTimer(&link->loop, rtoCurrent(&link->rto));
+            stop = FALSE;
+            while (stop == FALSE)
             {   
-                read(fd, &aux, 1);
-                determineStateDISC(&state, aux);
-                if(state == DONE) STOP = TRUE;
+                if(readFrame(link, &frame) && frame.type == FrameDisc) stop = TRUE;
+                // DISC or its answer lost, send it again
+                else if(link->failed){
+                    link->failed = FALSE;
+                    if(attempts++ == link->maxRetransmissions) break;
+                    rtoBackoff(&link->rto);
+                    writeFrame(link, msg, 5);
+                    loopSetTimer(&link->loop, rtoCurrent(&link->rto));
+                }
             }
+            loopSetTimer(&link->loop, 0);
 
             // Send UA
             unsigned char ua[256] = {0};
@@ -553,20 +1486,23 @@ int llclose(int statistics, LinkLayer linkLayer)
             ua[2] = 0x07;
             ua[3] = BCC(0x03,0x07);
             ua[4] = FLAG;
-            int bytes= write(fd, ua, UA_SIZE);
+            writeFrame(link, ua, UA_SIZE);
             printf("Sent UA\n");
             break;
 
         case LlRx:
-            STOP = FALSE;
-            state = START;
-            // receive DISC
-            while (STOP == FALSE)
+            // receive DISC, unless llread() already got it
+            stop = link->rxDiscReceived;
+            while (stop == FALSE)
             {   
-                read(fd, &aux, 1);
-                determineStateDISC(&state, aux);
-
-                if(state == DONE) STOP = TRUE;
+                if(!readFrame(link, &frame)) continue;
+                if(frame.type == FrameDisc) stop = TRUE;
+                else if(frame.type == FrameInfo && link->options.arq == ArqNone) continue;
+                // the RR of the last I-frame was lost, acknowledge it again
+                else if(frame.type == FrameInfo && link->options.arq == ArqSelectiveRepeat)
+                    sendSelectiveAck(link, FALSE);
+                else if(frame.type == FrameInfo) sendSupervision(link, ACK(link->sn));
+                else answerControlFrame(link, &frame);
             }
             printf("Received DISC\n");
 
@@ -576,29 +1512,114 @@ int llclose(int statistics, LinkLayer linkLayer)
             msg[2] = 0x0B;
             msg[3] = BCC(0x03,0x0B);
             msg[4] = FLAG;
-            bytes= write(fd, msg, 5);
+            writeFrame(link, msg, 5);
 
             //receiving UA
-            state = START;
-            STOP = FALSE;
-             while (STOP == FALSE)
+            loopSetTimer(&link->loop, rtoCurrent(&link->rto));
+            stop = FALSE;
+             while (stop == FALSE)
             {   
-                read(fd, &aux, 1);
-                determineState(&state, aux, 1);
-
-                if(state == DONE) STOP = TRUE;
+                int received = readFrame(link, &frame);
+                if(received && frame.type == FrameUa) stop = TRUE;
+                // our DISC was lost
+                else if((received && frame.type == FrameDisc) || link->failed){
+                    if(link->failed && attempts++ == link->maxRetransmissions) break;
+                    if(link->failed) rtoBackoff(&link->rto);
+                    link->failed = FALSE;
+                    writeFrame(link, msg, 5);
+                    loopSetTimer(&link->loop, rtoCurrent(&link->rto));
+                }
             }
+            loopSetTimer(&link->loop, 0);
              printf("Received UA\n");
 
             break;
     }
-      if (tcsetattr(fd,TCSANOW,&oldtio) != 0){
+    link->closedAt = rtoNow();
+    if(statistics) printStatistics(link, link->role);
+      if (tcsetattr(link->fd,TCSANOW,&link->oldtio) != 0){
         perror("llclose() - Error on tcsetattr()");
         return -1;
     }
-    if (close(fd) != 0){
+    loopClose(&link->loop);
+    if (close(link->fd) != 0){
         perror("llclose() - Error on close()");
         return -1;
     }
         return 1;
-}
\ No newline at end of file
+}
+
+int llclose_r(LinkConnection *link, int showStatistics)
+{
+    int result = disconnect(link, showStatistics);
+    free(link);
+    return result;
+}
+
+////////////////////////////////////////////////
+// DEFAULT CONNECTION
+////////////////////////////////////////////////
+// The functions of link_layer.h, for a process with a single link
+LinkConnection *default_link = NULL;
+LinkOptions default_options = {ArqStopAndWait, 0, FcsBcc, 0, 0, 0, 0};
+LinkStatistics default_statistics; // of the last connection closed
+
+void llsetoptions(LinkOptions linkOptions)
+{
+    default_options = linkOptions;
+}
+
+LinkOptions llgetoptions()
+{
+    return default_options;
+}
+
+LinkStatistics llgetstatistics()
+{
+    if(default_link == NULL) return default_statistics;
+    return llgetstatistics_r(default_link);
+}
+
+int llopen(LinkLayer connectionParameters)
+{
+    default_link = llopen_r(connectionParameters, default_options);
+    if(default_link == NULL) return -1;
+    default_options = default_link->options;
+    return default_link->fd;
+}
+
+int llwrite(const unsigned char *buf, int bufSize)
+{
+    return llwrite_r(default_link, buf, bufSize);
+}
+
+int llwritepacket(const unsigned char *header, int headerSize,
+                  const unsigned char *data, int dataSize)
+{
+    return llwritepacket_r(default_link, header, headerSize, data, dataSize);
+}
+
+int llwritev(const struct iovec *iov, int iovcnt)
+{
+    return llwritev_r(default_link, iov, iovcnt);
+}
+
+int lldrain()
+{
+    return lldrain_r(default_link);
+}
+
+int llread(unsigned char *packet)
+{
+    return llread_r(default_link, packet);
+}
+
+int llclose(int showStatistics, LinkLayer linkLayer)
+{
+    (void)linkLayer; // llopen() kept what it needs
+    int result = disconnect(default_link, showStatistics);
+    default_statistics = llgetstatistics_r(default_link);
+    free(default_link);
+    default_link = NULL;
+    return result;
+}
@@ -0,0 +1,234 @@
+// Reed-Solomon implementation
+
+#include "reed_solomon.h"
+#include <pthread.h>
+#include <string.h>
+
+#define FALSE 0
+#define TRUE 1
+#define GF_POLY 0x11D
+#define GF_ORDER 255 // nonzero elements, alpha^255 = 1
+
+// gfExp[i] = alpha^i, doubled so a sum of two logs needs no reduction
+static unsigned char gfExp[2 * GF_ORDER];
+static unsigned char gfLog[256];
+// built once, whichever thread gets there first
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+// Products by a constant, one 256-entry table per constant so the inner
+// loops are a lookup per byte: timesAlpha[j][x] = alpha^j x for the
+// syndromes, timesGenerator[p][j][x] = g[p-1-j] x for the encoder with p
+// parity bytes
+static unsigned char timesAlpha[RS_MAX_PARITY][256];
+static unsigned char timesGenerator[RS_MAX_PARITY + 1][RS_MAX_PARITY][256];
+
+static unsigned char gfMul(unsigned char a, unsigned char b);
+
+// g(x) = (x - alpha^0)(x - alpha^1)...(x - alpha^(p-1)), kept as the
+// products by its coefficients
+static void buildGenerator(int parity)
+{
+    unsigned char g[RS_MAX_PARITY + 1] = {1}; // lowest degree first
+    for(int i = 0; i < parity; i++){
+        // multiply by (x + alpha^i)
+        for(int j = i + 1; j > 0; j--) g[j] = g[j-1] ^ gfMul(g[j], gfExp[i]);
+        g[0] = gfMul(g[0], gfExp[i]);
+    }
+    for(int j = 0; j < parity; j++){
+        for(int x = 0; x < 256; x++) timesGenerator[parity][j][x] = gfMul(g[parity - 1 - j], x);
+    }
+}
+
+static void buildTables()
+{
+    unsigned int x = 1;
+    for(int i = 0; i < GF_ORDER; i++){
+        gfExp[i] = gfExp[i + GF_ORDER] = x;
+        gfLog[x] = i;
+        x <<= 1;
+        if(x & 0x100) x ^= GF_POLY;
+    }
+    for(int j = 0; j < RS_MAX_PARITY; j++){
+        timesAlpha[j][0] = 0;
+        for(int x = 1; x < 256; x++) timesAlpha[j][x] = gfExp[gfLog[x] + j];
+    }
+    for(int parity = 1; parity <= RS_MAX_PARITY; parity++) buildGenerator(parity);
+}
+
+static void initTables()
+{
+    pthread_once(&tablesOnce, buildTables);
+}
+
+static unsigned char gfMul(unsigned char a, unsigned char b)
+{
+    if(a == 0 || b == 0) return 0;
+    return gfExp[gfLog[a] + gfLog[b]];
+}
+
+static unsigned char gfDiv(unsigned char a, unsigned char b)
+{
+    if(a == 0) return 0;
+    return gfExp[gfLog[a] + GF_ORDER - gfLog[b]];
+}
+
+unsigned char gfMultiply(unsigned char a, unsigned char b)
+{
+    initTables();
+    return gfMul(a, b);
+}
+
+unsigned char gfInverse(unsigned char a)
+{
+    initTables();
+    return gfDiv(1, a);
+}
+
+void gfMulAdd(unsigned char *dst, const unsigned char *src, unsigned char c, int size)
+{
+    if(c == 0) return;
+    if(c == 1){
+        for(int i = 0; i < size; i++) dst[i] ^= src[i];
+        return;
+    }
+    initTables();
+    unsigned char times[256];
+    for(int x = 0; x < 256; x++) times[x] = gfMul(c, x);
+    for(int i = 0; i < size; i++) dst[i] ^= times[src[i]];
+}
+
+// alpha^(log * power), the power of an element given by its log
+static unsigned char gfPow(int log, int power)
+{
+    return gfExp[(log * power) % GF_ORDER];
+}
+
+int rsEncodedSize(int parity, int size)
+{
+    int dataPerBlock = RS_BLOCK - parity;
+    return size + (size + dataPerBlock - 1) / dataPerBlock * parity;
+}
+
+// Parity of one block: the remainder of data(x) x^p divided by g(x),
+// highest degree first
+static void encodeBlock(int parity, const unsigned char *data, int size, unsigned char *out)
+{
+    unsigned char (*times)[256] = timesGenerator[parity];
+    memset(out, 0, parity);
+    for(int i = 0; i < size; i++){
+        unsigned char feedback = data[i] ^ out[0];
+        for(int j = 0; j < parity - 1; j++) out[j] = out[j+1] ^ times[j][feedback];
+        out[parity - 1] = times[parity - 1][feedback];
+    }
+}
+
+int rsEncode(int parity, const unsigned char *data, int size, unsigned char *out)
+{
+    initTables();
+    int n = 0;
+    for(int i = 0; i < size; i += RS_BLOCK - parity){
+        int block = (size - i < RS_BLOCK - parity) ? size - i : RS_BLOCK - parity;
+        memcpy(out + n, data + i, block);
+        encodeBlock(parity, data + i, block, out + n + block);
+        n += block + parity;
+    }
+    return n;
+}
+
+/**
+ * @brief Corrects a block of size bytes, parity ones included: syndromes,
+ * Berlekamp-Massey for the error locator, Chien search for the positions
+ * and Forney for the values.
+ *
+ * @return number of bytes corrected, -1 if there were too many errors
+ */
+static int decodeBlock(int parity, unsigned char *block, int size)
+{
+    // S[j] = r(alpha^j), all zero for a codeword
+    unsigned char syndromes[RS_MAX_PARITY];
+    int clean = TRUE;
+    for(int j = 0; j < parity; j++){
+        const unsigned char *times = timesAlpha[j];
+        unsigned char s = 0;
+        for(int i = 0; i < size; i++) s = times[s] ^ block[i];
+        syndromes[j] = s;
+        if(s != 0) clean = FALSE;
+    }
+    if(clean) return 0;
+
+    // Berlekamp-Massey: shortest lambda(x) generating the syndromes
+    unsigned char lambda[RS_MAX_PARITY + 1] = {1};
+    unsigned char previous[RS_MAX_PARITY + 1] = {1};
+    unsigned char saved[RS_MAX_PARITY + 1];
+    int errors = 0, shift = 1;
+    unsigned char previousDelta = 1;
+    for(int r = 0; r < parity; r++){
+        unsigned char delta = syndromes[r];
+        for(int i = 1; i <= errors; i++) delta ^= gfMul(lambda[i], syndromes[r - i]);
+        if(delta == 0){
+            shift++;
+            continue;
+        }
+        unsigned char scale = gfDiv(delta, previousDelta);
+        int grow = 2 * errors <= r;
+        if(grow) memcpy(saved, lambda, sizeof(lambda));
+        for(int i = 0; i + shift <= parity; i++) lambda[i + shift] ^= gfMul(scale, previous[i]);
+        if(grow){
+            errors = r + 1 - errors;
+            memcpy(previous, saved, sizeof(previous));
+            previousDelta = delta;
+            shift = 1;
+        }
+        else shift++;
+    }
+    if(2 * errors > parity) return -1;
+
+    // omega(x) = S(x) lambda(x) mod x^p
+    unsigned char omega[RS_MAX_PARITY];
+    for(int i = 0; i < parity; i++){
+        omega[i] = 0;
+        for(int j = 0; j <= i && j <= errors; j++) omega[i] ^= gfMul(lambda[j], syndromes[i - j]);
+    }
+
+    // byte i has power k = size - 1 - i: it is wrong if lambda(alpha^-k) = 0,
+    // and then off by alpha^k omega(alpha^-k) / lambda'(alpha^-k)
+    int found = 0;
+    for(int i = 0; i < size && found < errors; i++){
+        int k = size - 1 - i;
+        int inverse = (GF_ORDER - k) % GF_ORDER;
+        unsigned char value = 0;
+        for(int j = 0; j <= errors; j++){
+            if(lambda[j] != 0) value ^= gfExp[(gfLog[lambda[j]] + inverse * j) % GF_ORDER];
+        }
+        if(value != 0) continue;
+
+        unsigned char numerator = 0, derivative = 0;
+        for(int j = 0; j < parity; j++){
+            if(omega[j] != 0) numerator ^= gfMul(omega[j], gfPow(inverse, j));
+        }
+        for(int j = 1; j <= errors; j += 2){
+            if(lambda[j] != 0) derivative ^= gfMul(lambda[j], gfPow(inverse, j - 1));
+        }
+        if(derivative == 0) return -1;
+        block[i] ^= gfMul(gfExp[k], gfDiv(numerator, derivative));
+        found++;
+    }
+    return (found == errors) ? errors : -1;
+}
+
+int rsDecode(int parity, unsigned char *buf, int size, int *corrected)
+{
+    initTables();
+    *corrected = 0;
+    int n = 0;
+    for(int i = 0; i < size; i += RS_BLOCK){
+        int block = (size - i < RS_BLOCK) ? size - i : RS_BLOCK;
+        if(block <= parity) return -1;
+        int fixed = decodeBlock(parity, buf + i, block);
+        if(fixed < 0) return -1;
+        *corrected += fixed;
+        memmove(buf + n, buf + i, block - parity);
+        n += block - parity;
+    }
+    return n;
+}
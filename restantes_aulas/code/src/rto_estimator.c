@@ -0,0 +1,58 @@
+// Retransmission timeout implementation
+
+#include "rto_estimator.h"
+#include <time.h>
+
+static int clampRto(double ms)
+{
+    if(ms < RTO_MIN_MS) return RTO_MIN_MS;
+    if(ms > RTO_MAX_MS) return RTO_MAX_MS;
+    return (int)ms;
+}
+
+void rtoInit(RtoEstimator *estimator, int initialMs)
+{
+    estimator->srtt = 0;
+    estimator->rttvar = 0;
+    estimator->rto = clampRto(initialMs);
+    estimator->backoff = 0;
+    estimator->samples = 0;
+}
+
+void rtoSample(RtoEstimator *estimator, double rttMs)
+{
+    if(estimator->samples++ == 0){
+        estimator->srtt = rttMs;
+        estimator->rttvar = rttMs / 2;
+    }
+    else{
+        double error = estimator->srtt - rttMs;
+        if(error < 0) error = -error;
+        estimator->rttvar += (error - estimator->rttvar) / 4;
+        estimator->srtt += (rttMs - estimator->srtt) / 8;
+    }
+    estimator->rto = clampRto(estimator->srtt + 4 * estimator->rttvar);
+    estimator->backoff = 0;
+}
+
+void rtoBackoff(RtoEstimator *estimator)
+{
+    if(rtoCurrent(estimator) < RTO_MAX_MS) estimator->backoff++;
+}
+
+void rtoReset(RtoEstimator *estimator)
+{
+    estimator->backoff = 0;
+}
+
+int rtoCurrent(const RtoEstimator *estimator)
+{
+    return clampRto((double)estimator->rto * (1 << estimator->backoff));
+}
+
+double rtoNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
@@ -0,0 +1,70 @@
+// Single-producer/single-consumer ring implementation
+
+#include "spsc_ring.h"
+#include <sched.h>
+#include <time.h>
+
+#define SPINS 100
+#define YIELDS 100
+
+// Waiting the other thread: spin, then yield, then sleep 50 us at a time
+static void backoff(int *attempt)
+{
+    if(*attempt < SPINS){
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else if(*attempt < SPINS + YIELDS){
+        sched_yield();
+    }
+    else{
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+        return;
+    }
+    (*attempt)++;
+}
+
+void ringInit(SpscRing *ring, unsigned int capacity)
+{
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+unsigned int ringAcquire(SpscRing *ring)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int attempt = 0;
+    while(head - atomic_load_explicit(&ring->tail, memory_order_acquire) == ring->capacity)
+        backoff(&attempt);
+    return head & (ring->capacity - 1);
+}
+
+void ringPublish(SpscRing *ring)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+unsigned int ringPeek(SpscRing *ring)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int attempt = 0;
+    while(atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+        backoff(&attempt);
+    return tail & (ring->capacity - 1);
+}
+
+void ringRelease(SpscRing *ring)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+unsigned int ringReady(SpscRing *ring)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+}